@@ -0,0 +1,478 @@
+#include "sse.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define XAI_SSE_X86 1
+#else
+#define XAI_SSE_X86 0
+#endif
+
+namespace {
+
+using Finder = const char *(*)(const char *, const char *);
+
+const char *ScalarLineEnd(const char *first, const char *last) {
+  for (; first != last; ++first) {
+    if (*first == '\n' || *first == '\r')
+      return first;
+  }
+  return last;
+}
+
+#if XAI_SSE_X86
+
+template <typename Vector> const Vector *Vec(const char *p) {
+  return static_cast<const Vector *>(static_cast<const void *>(p));
+}
+
+// Scans 16 bytes at a time. Inlined into the AVX2 scanner as well, so that
+// its tail is VEX-encoded and does not pay for switching back to SSE.
+__attribute__((target("sse2"), always_inline)) inline const char *
+Sse2Scan(const char *first, const char *last) {
+  const __m128i lf = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+
+  for (; last - first >= 16; first += 16) {
+    const __m128i bytes = _mm_loadu_si128(Vec<__m128i>(first));
+    const int mask = _mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(bytes, lf), _mm_cmpeq_epi8(bytes, cr)));
+    if (mask != 0)
+      return first + __builtin_ctz(static_cast<unsigned>(mask));
+  }
+
+  return ScalarLineEnd(first, last);
+}
+
+__attribute__((target("sse2"))) const char *Sse2LineEnd(const char *first,
+                                                        const char *last) {
+  return Sse2Scan(first, last);
+}
+
+__attribute__((target("avx2"))) const char *Avx2LineEnd(const char *first,
+                                                        const char *last) {
+  const __m256i lf = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8('\r');
+
+  for (; last - first >= 32; first += 32) {
+    const __m256i bytes = _mm256_loadu_si256(Vec<__m256i>(first));
+    const int mask = _mm256_movemask_epi8(_mm256_or_si256(
+        _mm256_cmpeq_epi8(bytes, lf), _mm256_cmpeq_epi8(bytes, cr)));
+    if (mask != 0)
+      return first + __builtin_ctz(static_cast<unsigned>(mask));
+  }
+
+  return Sse2Scan(first, last);
+}
+
+#endif
+
+sse::Isa Supported() {
+#if XAI_SSE_X86
+  if (__builtin_cpu_supports("avx2"))
+    return sse::Isa::avx2;
+  if (__builtin_cpu_supports("sse2"))
+    return sse::Isa::sse2;
+#endif
+  return sse::Isa::scalar;
+}
+
+const char *Resolve(const char *first, const char *last);
+
+// The first scan goes through Resolve, which installs the best scanner.
+std::atomic<Finder> finder{Resolve};
+std::atomic<sse::Isa> selected{sse::Isa::scalar};
+
+void Install(sse::Isa isa) {
+  isa = std::min(isa, Supported());
+
+  Finder find = ScalarLineEnd;
+#if XAI_SSE_X86
+  if (isa == sse::Isa::avx2)
+    find = Avx2LineEnd;
+  else if (isa == sse::Isa::sse2)
+    find = Sse2LineEnd;
+#endif
+
+  selected.store(isa, std::memory_order_relaxed);
+  finder.store(find, std::memory_order_relaxed);
+}
+
+const char *Resolve(const char *first, const char *last) {
+  Install(sse::Isa::avx2);
+  return finder.load(std::memory_order_relaxed)(first, last);
+}
+
+// Cursor over the JSON of an event. Every read returns false on input it
+// does not expect.
+class Json {
+public:
+  explicit Json(std::string_view text)
+      : p_{text.data()}, end_{text.data() + text.size()} {}
+
+  bool Consume(char c) {
+    SkipSpace();
+    if (p_ == end_ || *p_ != c)
+      return false;
+    ++p_;
+    return true;
+  }
+
+  bool AtEnd() {
+    SkipSpace();
+    return p_ == end_;
+  }
+
+  // Reads a string as it appears in the text, escape sequences included.
+  bool String(std::string_view &raw, bool &escaped) {
+    if (!Consume('"'))
+      return false;
+
+    const char *begin = p_;
+    escaped = false;
+
+    for (;;) {
+      while (p_ != end_ && *p_ != '"' && *p_ != '\\')
+        ++p_;
+      if (p_ == end_)
+        return false;
+      if (*p_ == '"')
+        break;
+      escaped = true;
+      if (end_ - p_ < 2)
+        return false;
+      p_ += 2;
+    }
+
+    raw = {begin, p_++};
+    return true;
+  }
+
+  // Reads a string without escape sequences, or null as an empty string.
+  bool PlainString(std::string_view &value) {
+    if (Literal("null")) {
+      value = {};
+      return true;
+    }
+    bool escaped;
+    return String(value, escaped) && !escaped;
+  }
+
+  // Reads a string into `scratch` if it has to be unescaped, or null as an
+  // empty string.
+  bool Text(std::string_view &value, std::string &scratch) {
+    if (Literal("null")) {
+      value = {};
+      return true;
+    }
+
+    bool escaped;
+    if (!String(value, escaped))
+      return false;
+    if (!escaped)
+      return true;
+
+    if (!Unescape(value, scratch))
+      return false;
+    value = scratch;
+    return true;
+  }
+
+  // Calls `member` with every key of an object; it has to read the value.
+  template <typename Member> bool Object(Member member) {
+    if (!Consume('{'))
+      return false;
+    if (Consume('}'))
+      return true;
+
+    do {
+      std::string_view key;
+      bool escaped;
+      if (!String(key, escaped) || escaped || !Consume(':') || !member(key))
+        return false;
+    } while (Consume(','));
+
+    return Consume('}');
+  }
+
+  bool Skip() {
+    SkipSpace();
+    if (p_ == end_)
+      return false;
+
+    std::string_view raw;
+    bool escaped;
+
+    switch (*p_) {
+    case '"':
+      return String(raw, escaped);
+    case '{':
+    case '[': {
+      int depth = 0;
+      do {
+        if (p_ == end_)
+          return false;
+        if (*p_ == '"') {
+          if (!String(raw, escaped))
+            return false;
+          continue;
+        }
+        if (*p_ == '{' || *p_ == '[')
+          ++depth;
+        else if (*p_ == '}' || *p_ == ']')
+          --depth;
+        ++p_;
+      } while (depth > 0);
+      return true;
+    }
+    default: {
+      const char *begin = p_;
+      while (p_ != end_ && *p_ != ',' && *p_ != '}' && *p_ != ']' &&
+             !Space(*p_))
+        ++p_;
+      return p_ != begin;
+    }
+    }
+  }
+
+private:
+  static bool Space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+  }
+
+  void SkipSpace() {
+    while (p_ != end_ && Space(*p_))
+      ++p_;
+  }
+
+  bool Literal(std::string_view word) {
+    SkipSpace();
+    if (!std::string_view{p_, end_}.starts_with(word))
+      return false;
+    p_ += word.size();
+    return true;
+  }
+
+  static bool Hex(std::string_view digits, std::uint32_t &code) {
+    code = 0;
+    for (char c : digits) {
+      code <<= 4;
+      if (c >= '0' && c <= '9')
+        code |= static_cast<std::uint32_t>(c - '0');
+      else if (c >= 'a' && c <= 'f')
+        code |= static_cast<std::uint32_t>(c - 'a' + 10);
+      else if (c >= 'A' && c <= 'F')
+        code |= static_cast<std::uint32_t>(c - 'A' + 10);
+      else
+        return false;
+    }
+    return true;
+  }
+
+  static void Utf8(std::uint32_t code, std::string &out) {
+    if (code < 0x80) {
+      out.push_back(static_cast<char>(code));
+    } else if (code < 0x800) {
+      out.push_back(static_cast<char>(0xc0 | (code >> 6)));
+      out.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+    } else if (code < 0x10000) {
+      out.push_back(static_cast<char>(0xe0 | (code >> 12)));
+      out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+      out.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+    } else {
+      out.push_back(static_cast<char>(0xf0 | (code >> 18)));
+      out.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3f)));
+      out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+      out.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+    }
+  }
+
+  static bool Unescape(std::string_view raw, std::string &out) {
+    out.clear();
+
+    for (std::size_t i = 0; i < raw.size(); ++i) {
+      if (raw[i] != '\\') {
+        out.push_back(raw[i]);
+        continue;
+      }
+
+      switch (raw[++i]) {
+      case '"':
+      case '\\':
+      case '/':
+        out.push_back(raw[i]);
+        break;
+      case 'b':
+        out.push_back('\b');
+        break;
+      case 'f':
+        out.push_back('\f');
+        break;
+      case 'n':
+        out.push_back('\n');
+        break;
+      case 'r':
+        out.push_back('\r');
+        break;
+      case 't':
+        out.push_back('\t');
+        break;
+      case 'u': {
+        std::uint32_t code;
+        if (raw.size() - i < 5 || !Hex(raw.substr(i + 1, 4), code))
+          return false;
+        i += 4;
+
+        // Characters outside the BMP come as a surrogate pair.
+        if (code >= 0xd800 && code < 0xdc00) {
+          std::uint32_t low;
+          if (raw.size() - i < 7 || raw.substr(i + 1, 2) != "\\u" ||
+              !Hex(raw.substr(i + 3, 4), low) || low < 0xdc00 ||
+              low >= 0xe000)
+            return false;
+          i += 6;
+          code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+        } else if (code >= 0xdc00 && code < 0xe000) {
+          return false;
+        }
+
+        Utf8(code, out);
+        break;
+      }
+      default:
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  const char *p_, *end_;
+};
+
+} // namespace
+
+namespace sse {
+
+const char *FindLineEnd(const char *first, const char *last) {
+  return finder.load(std::memory_order_relaxed)(first, last);
+}
+
+Isa CurrentIsa() {
+  if (finder.load(std::memory_order_relaxed) == Resolve)
+    Install(Isa::avx2);
+  return selected.load(std::memory_order_relaxed);
+}
+
+void ForceIsa(Isa isa) { Install(isa); }
+
+bool ExtractDelta(std::string_view data, xai::Delta &delta,
+                  std::string &scratch) {
+  Json json{data};
+  bool found = false;
+
+  delta = {};
+
+  // Only the first choice is read; the others are skipped.
+  const auto choice = [&](std::string_view key) {
+    if (key == "finish_reason")
+      return json.PlainString(delta.finish_reason);
+    if (key != "delta")
+      return json.Skip();
+
+    found = true;
+    return json.Object([&](std::string_view field) {
+      if (field == "content")
+        return json.Text(delta.content, scratch);
+      if (field == "role")
+        return json.PlainString(delta.role);
+      if (field == "tool_calls")
+        return false;
+      return json.Skip();
+    });
+  };
+
+  const bool read = json.Object([&](std::string_view key) {
+    if (key == "error")
+      return false;
+    if (key != "choices")
+      return json.Skip();
+
+    if (!json.Consume('[') || !json.Object(choice))
+      return false;
+    while (json.Consume(',')) {
+      if (!json.Skip())
+        return false;
+    }
+    return json.Consume(']');
+  });
+
+  return read && found && json.AtEnd();
+}
+
+void Decoder::Feed(std::string_view bytes, const Event &event) {
+  const char *first = bytes.data(), *last = first + bytes.size();
+
+  // A "\r\n" split between two pieces ends a single line, even with empty
+  // pieces in between.
+  if (first == last)
+    return;
+  if (cr_ && *first == '\n')
+    ++first;
+  cr_ = false;
+
+  while (first != last) {
+    const char *end = FindLineEnd(first, last);
+
+    if (end == last) {
+      line_.append(first, last);
+      return;
+    }
+
+    // Lines that arrive whole are decoded in place.
+    if (line_.empty()) {
+      Line({first, end}, event);
+    } else {
+      line_.append(first, end);
+      Line(line_, event);
+      line_.clear();
+    }
+
+    first = end + 1;
+    if (*end == '\r') {
+      if (first == last)
+        cr_ = true;
+      else if (*first == '\n')
+        ++first;
+    }
+  }
+}
+
+void Decoder::Line(std::string_view line, const Event &event) {
+  if (line.empty()) {
+    if (pending_) {
+      event(data_);
+      data_.clear();
+      pending_ = false;
+    }
+    return;
+  }
+
+  // Comments start with a colon; the event, id and retry fields are not used.
+  std::string_view value;
+  if (line.starts_with("data:"))
+    value = line.substr(5);
+  else if (line != "data")
+    return;
+
+  if (value.starts_with(' '))
+    value.remove_prefix(1);
+
+  if (pending_)
+    data_.push_back('\n');
+  data_.append(value);
+  pending_ = true;
+}
+
+} // namespace sse
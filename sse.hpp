@@ -0,0 +1,49 @@
+#pragma once
+
+#include "xai.hpp"
+
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace sse {
+
+// Incremental decoder for a text/event-stream body. The stream can be fed in
+// pieces split anywhere; the data of an event is handed over once the blank
+// line that ends it arrives.
+class Decoder {
+public:
+  using Event = std::function<void(std::string_view data)>;
+
+  void Feed(std::string_view bytes, const Event &event);
+
+private:
+  void Line(std::string_view line, const Event &event);
+
+  std::string line_, data_;
+  bool cr_ = false, pending_ = false;
+};
+
+// Reads the delta of a chat completion chunk straight from the event data,
+// without building a JSON document. Returns false for events it does not
+// handle, such as tool calls, errors or unexpected shapes; those need the
+// full parser. The views point into `data`, or into `scratch` when the
+// content has escape sequences. The parts of the event that are skipped are
+// not validated.
+bool ExtractDelta(std::string_view data, xai::Delta &delta,
+                  std::string &scratch);
+
+// Instruction sets the line scanner can use.
+enum class Isa { scalar, sse2, avx2 };
+
+// Returns the first CR or LF in [first, last), or `last`. The scan uses the
+// widest instruction set the CPU supports, chosen on the first call.
+const char *FindLineEnd(const char *first, const char *last);
+
+Isa CurrentIsa();
+
+// Restricts the scanner to `isa`, or to the best set below it that the CPU
+// supports. Meant for benchmarks.
+void ForceIsa(Isa isa);
+
+} // namespace sse
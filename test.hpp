@@ -1,7 +1,10 @@
 #include <boost/asio/ssl/context.hpp>
 
+#include <string_view>
+
 namespace test {
 
+std::string_view certificate();
 void load_certs(boost::asio::ssl::context &);
 
 } // namespace test
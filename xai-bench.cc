@@ -0,0 +1,436 @@
+#include "sse.hpp"
+#include "test.hpp"
+#include "xai.hpp"
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <latch>
+#include <limits>
+#include <sstream>
+#include <string_view>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Answers every request on the connections it accepts with `body`, holding
+// each one for as long as its body would take to arrive over an uplink of the
+// given bandwidth in bytes per second.
+static void ServerRun(boost::asio::ip::tcp::acceptor &acceptor, double uplink,
+                      std::size_t connections, const std::string &body) {
+  boost::asio::ssl::context ctx{boost::asio::ssl::context::tlsv12};
+
+  test::load_certs(ctx);
+
+  for (std::size_t i = 0; i < connections; ++i) {
+    boost::asio::ip::tcp::socket socket{acceptor.get_executor()};
+
+    acceptor.accept(socket);
+
+    boost::beast::error_code ec;
+
+    boost::asio::ssl::stream<boost::asio::ip::tcp::socket &> stream{socket,
+                                                                    ctx};
+
+    stream.handshake(boost::asio::ssl::stream_base::server, ec);
+    if (ec) {
+      std::cerr << "handshake: " << ec.message() << std::endl;
+      continue;
+    }
+
+    boost::beast::flat_buffer buffer;
+
+    for (;;) {
+      boost::beast::http::request<boost::beast::http::string_body> req;
+      boost::beast::http::read(stream, buffer, req, ec);
+      if (ec)
+        break;
+
+      std::this_thread::sleep_for(std::chrono::duration<double>{
+          static_cast<double>(req.body().size()) / uplink});
+
+      boost::beast::http::response<boost::beast::http::string_body> res{
+          boost::beast::http::status::ok, req.version()};
+      res.set(boost::beast::http::field::content_type, "application/json");
+      res.keep_alive(req.keep_alive());
+      res.body() = body;
+      res.prepare_payload();
+
+      boost::beast::http::write(stream, res, ec);
+      if (ec)
+        break;
+    }
+  }
+}
+
+static double ThreadCpuMilliseconds() {
+  timespec ts{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<double>(ts.tv_sec) * 1e3 +
+         static_cast<double>(ts.tv_nsec) / 1e6;
+}
+
+// A conversation of alternating turns with roughly `size` bytes of text.
+static std::unique_ptr<xai::Messages> Conversation(std::size_t size) {
+  auto messages = xai::Messages::Make("grok-beta");
+
+  std::size_t total = 0;
+  for (std::size_t turn = 0; total < size; ++turn) {
+    std::string text = "Turn " + std::to_string(turn) +
+                       ": could you explain how the connection pool keeps "
+                       "sockets warm between calls, and what happens when "
+                       "the server closes an idle keep-alive connection "
+                       "before the client notices it?";
+    total += text.size();
+
+    if (turn % 2 == 0)
+      messages->AddU(text.c_str());
+    else
+      messages->AddA(text.c_str());
+  }
+
+  return messages;
+}
+
+static xai::Client::Options
+LocalOptions(const boost::asio::ip::tcp::acceptor &acceptor,
+             const std::filesystem::path &ca_file) {
+  xai::Client::Options options;
+  options.pool_max = 1;
+  options.port = std::to_string(acceptor.local_endpoint().port());
+  options.ca_file = ca_file.string();
+  return options;
+}
+
+static void Row(const std::function<void()> &call, int rounds) {
+  // The first call pays for the handshake.
+  call();
+
+  const double cpu = ThreadCpuMilliseconds();
+  const auto start = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < rounds; ++i) {
+    call();
+  }
+
+  const std::chrono::duration<double, std::milli> wall =
+      std::chrono::steady_clock::now() - start;
+
+  std::cout << std::setw(12) << std::fixed << std::setprecision(2)
+            << wall.count() / rounds << std::setw(12)
+            << (ThreadCpuMilliseconds() - cpu) / rounds << std::endl;
+}
+
+// Upload time against CPU cost of compressing request bodies.
+static void Compression(const std::filesystem::path &ca_file, double mbps) {
+  constexpr int rounds = 20;
+  const std::size_t sizes[] = {16 * 1024, 128 * 1024, 512 * 1024};
+  const std::size_t thresholds[] = {0, 1024};
+
+  boost::asio::io_context ioc;
+  boost::asio::ip::tcp::acceptor acceptor{
+      ioc, {boost::asio::ip::make_address("127.0.0.1"), 0}};
+
+  const std::string body =
+      "{\"choices\":[{\"message\":{\"content\":\"ok\"}}]}";
+
+  std::thread server{ServerRun, std::ref(acceptor), mbps * 1e6 / 8,
+                     std::size(sizes) * std::size(thresholds), body};
+
+  std::cout << "uplink " << mbps << " Mbit/s, " << rounds
+            << " requests per row\n\n"
+            << std::setw(10) << "body KiB" << std::setw(12) << "threshold"
+            << std::setw(12) << "wall ms" << std::setw(12) << "cpu ms"
+            << std::endl;
+
+  for (std::size_t size : sizes) {
+    auto messages = Conversation(size);
+
+    for (std::size_t threshold : thresholds) {
+      xai::Client::Options options = LocalOptions(acceptor, ca_file);
+      options.compress_threshold = threshold;
+
+      auto client = xai::Client::Make("bench_key", "localhost", options);
+
+      std::cout << std::setw(10) << size / 1024 << std::setw(12) << threshold;
+      Row([&] { (void)client->ChatCompletion(messages); }, rounds);
+    }
+  }
+
+  server.join();
+}
+
+// Client CPU spent reading large responses with userspace TLS and with the
+// record layer offloaded to the kernel. Without the tls kernel module or an
+// OpenSSL built with kTLS support, both rows run in userspace; the kernel
+// column shows whether the kernel took over.
+static void KernelTls(const std::filesystem::path &ca_file) {
+  constexpr int rounds = 20;
+  const std::size_t size = 4 * 1024 * 1024;
+
+  boost::asio::io_context ioc;
+  boost::asio::ip::tcp::acceptor acceptor{
+      ioc, {boost::asio::ip::make_address("127.0.0.1"), 0}};
+
+  std::thread server{ServerRun, std::ref(acceptor),
+                     std::numeric_limits<double>::infinity(), std::size_t{2},
+                     "{\"choices\":[{\"message\":{\"content\":\"" +
+                         std::string(size, 'x') + "\"}}]}"};
+
+  std::cout << size / 1024 << " KiB responses, " << rounds
+            << " requests per row\n\n"
+            << std::setw(10) << "kTLS" << std::setw(10) << "kernel"
+            << std::setw(12) << "wall ms"
+            << std::setw(12) << "cpu ms" << std::endl;
+
+  auto messages = xai::Messages::Make("grok-beta");
+  messages->AddU("hello");
+
+  for (bool kernel_tls : {false, true}) {
+    xai::Client::Options options = LocalOptions(acceptor, ca_file);
+    options.kernel_tls = kernel_tls;
+
+    auto client = xai::Client::Make("bench_key", "localhost", options);
+
+    std::cout << std::setw(10) << (kernel_tls ? "on" : "off") << std::setw(10)
+              << (client->KernelTlsActive() ? "yes" : "no");
+    Row([&] { (void)client->ChatCompletion(messages); }, rounds);
+  }
+
+  server.join();
+}
+
+// Sends an event stream of `events` chunks in answer to each request on the
+// connection.
+static void StreamSession(boost::asio::ssl::context &ctx,
+                          boost::asio::ip::tcp::socket socket,
+                          std::size_t events) {
+  boost::beast::error_code ec;
+
+  boost::asio::ssl::stream<boost::asio::ip::tcp::socket &> stream{socket,
+                                                                  ctx};
+  stream.handshake(boost::asio::ssl::stream_base::server, ec);
+  if (ec)
+    return;
+
+  std::string response = "HTTP/1.1 200 OK\r\n"
+                         "Content-Type: text/event-stream\r\n"
+                         "Transfer-Encoding: chunked\r\n\r\n";
+
+  const std::string event =
+      "data: {\"choices\":[{\"delta\":{\"content\":\"token\"}}]}\n\n";
+  for (std::size_t i = 0; i < events; ++i) {
+    std::ostringstream chunk;
+    chunk << std::hex << event.size() << "\r\n" << event << "\r\n";
+    response += chunk.str();
+  }
+  response += "e\r\ndata: [DONE]\n\n\r\n0\r\n\r\n";
+
+  boost::beast::flat_buffer buffer;
+  for (;;) {
+    boost::beast::http::request<boost::beast::http::string_body> req;
+    boost::beast::http::read(stream, buffer, req, ec);
+    if (ec)
+      return;
+
+    boost::asio::write(stream, boost::asio::buffer(response), ec);
+    if (ec)
+      return;
+  }
+}
+
+// Accepts connections until `ioc` is stopped, serving each on its own thread.
+static void StreamServerRun(boost::asio::io_context &ioc,
+                            boost::asio::ip::tcp::acceptor &acceptor,
+                            std::size_t events) {
+  boost::asio::ssl::context ctx{boost::asio::ssl::context::tlsv12};
+
+  test::load_certs(ctx);
+
+  std::vector<std::jthread> sessions;
+
+  std::function<void()> accept = [&] {
+    acceptor.async_accept([&](boost::beast::error_code ec,
+                              boost::asio::ip::tcp::socket socket) {
+      if (ec)
+        return;
+
+      sessions.emplace_back(StreamSession, std::ref(ctx), std::move(socket),
+                            events);
+      accept();
+    });
+  };
+
+  accept();
+  ioc.run();
+}
+
+// Event throughput of many concurrent streams on the client's I/O thread.
+// The pool is warmed up before the clock starts, so only the streams are
+// timed and not the handshakes. Build once with and once without
+// XAI_ENABLE_IO_URING to compare epoll with io_uring.
+static void Streams(const std::filesystem::path &ca_file, std::size_t streams) {
+  constexpr std::size_t events = 1000;
+
+  boost::asio::io_context ioc;
+  boost::asio::ip::tcp::acceptor acceptor{
+      ioc, {boost::asio::ip::make_address("127.0.0.1"), 0}};
+
+  std::thread server{StreamServerRun, std::ref(ioc), std::ref(acceptor),
+                     events};
+
+#ifdef BOOST_ASIO_HAS_IO_URING
+  std::cout << "io_uring, ";
+#else
+  std::cout << "epoll, ";
+#endif
+  std::cout << streams << " streams of " << events << " events\n\n"
+            << std::setw(12) << "wall ms" << std::setw(14) << "events/s"
+            << std::setw(10) << "failed" << std::endl;
+
+  {
+    xai::Client::Options options = LocalOptions(acceptor, ca_file);
+    options.pool_min = streams;
+    options.pool_max = streams;
+
+    auto client = xai::Client::Make("bench_key", "localhost", options);
+    auto messages = xai::Messages::Make("grok-beta");
+    messages->AddU("hello");
+
+    std::atomic<std::size_t> received = 0, failed = 0;
+    std::latch done{static_cast<std::ptrdiff_t>(streams)};
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (std::size_t i = 0; i < streams; ++i) {
+      client->AsyncChatCompletion(
+          messages,
+          [&](std::unique_ptr<xai::Choices>) {
+            received.fetch_add(1, std::memory_order_relaxed);
+          },
+          [&](std::exception_ptr e) {
+            if (e)
+              ++failed;
+            done.count_down();
+          });
+    }
+
+    done.wait();
+
+    const std::chrono::duration<double> wall =
+        std::chrono::steady_clock::now() - start;
+
+    std::cout << std::setw(12) << std::fixed << std::setprecision(2)
+              << wall.count() * 1e3 << std::setw(14) << std::setprecision(0)
+              << static_cast<double>(received.load()) / wall.count()
+              << std::setw(10) << failed.load() << std::endl;
+  }
+
+  ioc.stop();
+  server.join();
+}
+
+// An event stream shaped like the API's: one chunk object per token.
+static std::string RecordedStream(std::size_t events) {
+  std::string stream;
+  for (std::size_t i = 0; i < events; ++i) {
+    stream += "data: {\"id\":\"3f0c2a51-8d1e-4b7a-9c55-0e6f1d2b7a90\","
+              "\"object\":\"chat.completion.chunk\",\"created\":1733000000,"
+              "\"model\":\"grok-beta\",\"choices\":[{\"index\":0,"
+              "\"delta\":{\"content\":\" token" +
+              std::to_string(i) +
+              "\",\"role\":\"assistant\"}}],"
+              "\"system_fingerprint\":\"fp_1a2b3c4d5e\"}\r\n\r\n";
+  }
+  return stream + "data: [DONE]\r\n\r\n";
+}
+
+// Decoding throughput of a recorded event stream with each line scanner.
+// The stream is fed in segment-sized pieces, as reads would deliver it.
+static void Sse(const std::string &file) {
+  constexpr std::size_t segment = 1448;
+
+  std::string stream;
+  if (file.empty()) {
+    stream = RecordedStream(10000);
+  } else {
+    std::ostringstream contents;
+    contents << std::ifstream{file, std::ios::binary}.rdbuf();
+    stream = contents.str();
+  }
+
+  std::cout << stream.size() / 1024 << " KiB stream in " << segment
+            << "-byte reads\n\n"
+            << std::setw(10) << "isa" << std::setw(12) << "MB/s"
+            << std::setw(14) << "events/s" << std::endl;
+
+  for (sse::Isa isa : {sse::Isa::scalar, sse::Isa::sse2, sse::Isa::avx2}) {
+    sse::ForceIsa(isa);
+    if (sse::CurrentIsa() != isa)
+      continue;
+
+    std::size_t events = 0, rounds = 0;
+    const sse::Decoder::Event count = [&](std::string_view) { ++events; };
+
+    const auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> wall{};
+
+    while (wall.count() < 0.5) {
+      sse::Decoder decoder;
+      for (std::size_t pos = 0; pos < stream.size(); pos += segment) {
+        decoder.Feed(std::string_view{stream}.substr(pos, segment), count);
+      }
+      ++rounds;
+      wall = std::chrono::steady_clock::now() - start;
+    }
+
+    const char *names[] = {"scalar", "sse2", "avx2"};
+    std::cout << std::setw(10) << names[static_cast<int>(isa)] << std::setw(12)
+              << std::fixed << std::setprecision(0)
+              << static_cast<double>(stream.size() * rounds) / 1e6 /
+                     wall.count()
+              << std::setw(14) << static_cast<double>(events) / wall.count()
+              << std::endl;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const std::string mode = argc > 1 ? argv[1] : "compression";
+
+  if (mode == "sse") {
+    Sse(argc > 2 ? argv[2] : "");
+    return 0;
+  }
+
+  if (mode != "compression" && mode != "ktls" && mode != "streams") {
+    std::cerr << "Usage: " << argv[0]
+              << " [compression [Mbit/s] | ktls | streams [count] | sse [file]]"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const std::filesystem::path ca_file =
+      std::filesystem::temp_directory_path() / "xai-bench-ca.pem";
+  std::ofstream{ca_file} << test::certificate();
+
+  if (mode == "ktls")
+    KernelTls(ca_file);
+  else if (mode == "streams")
+    Streams(ca_file, argc > 2 ? std::stoul(argv[2]) : 256);
+  else
+    Compression(ca_file, argc > 2 ? std::stod(argv[2]) : 10.0);
+
+  std::filesystem::remove(ca_file);
+
+  return 0;
+}
@@ -12,10 +12,15 @@ int main(int argc, char *argv[]) {
 
   const char *apikey{argv[1]};
 
-  auto client = xai::Client::Make(apikey);
+  xai::Client::Options options;
+  options.background_connect = true;
+
+  auto client = xai::Client::Make(apikey, options);
   auto messages = xai::Messages::Make("grok-beta");
 
   while (true) {
+    client->Prewarm();
+
     std::cout << ">>> ";
 
     std::string line;
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 
+#include "sse.hpp"
 #include "test.hpp"
 #include "xai.hpp"
 
@@ -8,7 +9,28 @@
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
+#include <sys/socket.h>
+#include <zlib.h>
+
+#ifdef XAI_HTTP2
+#include <nghttp2/nghttp2.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 static void ServerRun() {
   try {
@@ -77,6 +99,524 @@ static void ServerRun() {
   }
 }
 
+namespace {
+
+// Client options reaching a test server on `port` and trusting its
+// certificate.
+xai::Client::Options LoopbackOptions(unsigned short port) {
+  const std::filesystem::path ca_file =
+      std::filesystem::temp_directory_path() / "xai-test-ca.pem";
+  std::ofstream{ca_file} << test::certificate();
+
+  xai::Client::Options options;
+  options.port = std::to_string(port);
+  options.ca_file = ca_file.string();
+  return options;
+}
+
+// TLS server on a loopback port picked by the system. Each connection is
+// served by its own thread, which hands every request to the handler along
+// with the stream to answer on, until the handler returns false.
+class TestServer {
+public:
+  using Stream = boost::asio::ssl::stream<boost::asio::ip::tcp::socket>;
+  using Request = boost::beast::http::request<boost::beast::http::string_body>;
+  using Handler = std::function<bool(const Request &, Stream &)>;
+
+  explicit TestServer(Handler handler)
+      : handler_{std::move(handler)},
+        acceptor_{io_context_,
+                  {boost::asio::ip::make_address("127.0.0.1"), 0}} {
+    test::load_certs(ssl_context_);
+    thread_ = std::thread{[this] { Accept(); }};
+  }
+
+  TestServer(const TestServer &) = delete;
+  TestServer &operator=(const TestServer &) = delete;
+
+  ~TestServer() {
+    stopping_ = true;
+
+    boost::beast::error_code ec;
+    boost::asio::ip::tcp::socket wake{io_context_};
+    wake.connect(acceptor_.local_endpoint(), ec);
+    thread_.join();
+
+    for (Stream &stream : streams_) {
+      ::shutdown(stream.next_layer().native_handle(), SHUT_RDWR);
+    }
+    for (std::thread &session : sessions_) {
+      session.join();
+    }
+  }
+
+  // Client options reaching this server and trusting its certificate.
+  xai::Client::Options Options() const { return LoopbackOptions(port()); }
+
+  unsigned short port() const { return acceptor_.local_endpoint().port(); }
+
+  std::size_t connections() const { return connections_; }
+  std::size_t requests() const { return requests_; }
+  std::size_t resumed() const { return resumed_; }
+
+private:
+  void Accept() {
+    for (;;) {
+      boost::asio::ip::tcp::socket socket{io_context_};
+      boost::beast::error_code ec;
+      acceptor_.accept(socket, ec);
+      if (stopping_)
+        return;
+      if (ec)
+        continue;
+
+      ++connections_;
+      Stream &stream = streams_.emplace_back(std::move(socket), ssl_context_);
+      sessions_.emplace_back([this, &stream] { Serve(stream); });
+    }
+  }
+
+  void Serve(Stream &stream) {
+    boost::beast::error_code ec;
+    stream.handshake(boost::asio::ssl::stream_base::server, ec);
+    if (!ec && SSL_session_reused(stream.native_handle()))
+      ++resumed_;
+
+    boost::beast::flat_buffer buffer;
+    while (!ec) {
+      Request request;
+      boost::beast::http::read(stream, buffer, request, ec);
+      if (ec)
+        break;
+
+      ++requests_;
+      if (!handler_(request, stream))
+        break;
+    }
+
+    ::shutdown(stream.next_layer().native_handle(), SHUT_RDWR);
+  }
+
+  Handler handler_;
+  boost::asio::io_context io_context_;
+  boost::asio::ssl::context ssl_context_{
+      boost::asio::ssl::context::tls_server};
+  boost::asio::ip::tcp::acceptor acceptor_;
+  std::list<Stream> streams_;
+  std::list<std::thread> sessions_;
+  std::thread thread_;
+  std::atomic<bool> stopping_{false};
+  std::atomic<std::size_t> connections_{0}, requests_{0}, resumed_{0};
+};
+
+constexpr std::string_view completion =
+    R"({"choices":[{"message":{"content":"foo content"}}]})";
+
+// Answers with a JSON body and keeps the connection if the client asked to.
+bool Reply(TestServer::Stream &stream, const TestServer::Request &request,
+           std::string_view body = completion) {
+  boost::beast::http::response<boost::beast::http::string_body> response{
+      boost::beast::http::status::ok, request.version()};
+  response.set(boost::beast::http::field::content_type, "application/json");
+  response.keep_alive(request.keep_alive());
+  response.body() = body;
+  response.prepare_payload();
+
+  boost::beast::error_code ec;
+  boost::beast::http::write(stream, response, ec);
+  return !ec && request.keep_alive();
+}
+
+#ifdef XAI_HTTP2
+// HTTP/2 counterpart of TestServer that answers every request with the same
+// event stream. Responses wait until `batch` requests are open on the
+// connection, and without `end` the streams stay open after their events
+// until the client resets them.
+class Http2TestServer {
+public:
+  explicit Http2TestServer(std::vector<std::string> events,
+                           std::size_t batch = 1, bool end = true)
+      : batch_{batch}, end_{end},
+        acceptor_{io_context_,
+                  {boost::asio::ip::make_address("127.0.0.1"), 0}} {
+    for (const std::string &event : events) {
+      body_ += "data: " + event + "\n\n";
+    }
+
+    test::load_certs(ssl_context_);
+    SSL_CTX_set_alpn_select_cb(
+        ssl_context_.native_handle(),
+        [](SSL *, const unsigned char **out, unsigned char *size,
+           const unsigned char *in, unsigned int in_size, void *) {
+          static constexpr unsigned char h2[] = "\x02h2";
+          return SSL_select_next_proto(const_cast<unsigned char **>(out), size,
+                                       h2, sizeof(h2) - 1, in, in_size) ==
+                         OPENSSL_NPN_NEGOTIATED
+                     ? SSL_TLSEXT_ERR_OK
+                     : SSL_TLSEXT_ERR_NOACK;
+        },
+        nullptr);
+
+    thread_ = std::thread{[this] { Accept(); }};
+  }
+
+  Http2TestServer(const Http2TestServer &) = delete;
+  Http2TestServer &operator=(const Http2TestServer &) = delete;
+
+  ~Http2TestServer() {
+    stopping_ = true;
+
+    boost::beast::error_code ec;
+    boost::asio::ip::tcp::socket wake{io_context_};
+    wake.connect(acceptor_.local_endpoint(), ec);
+    thread_.join();
+
+    for (TestServer::Stream &stream : streams_) {
+      ::shutdown(stream.next_layer().native_handle(), SHUT_RDWR);
+    }
+    for (std::thread &session : sessions_) {
+      session.join();
+    }
+  }
+
+  xai::Client::Options Options() const {
+    return LoopbackOptions(acceptor_.local_endpoint().port());
+  }
+
+  std::size_t connections() const { return connections_; }
+  std::size_t requests() const { return requests_; }
+  std::size_t resets() const { return resets_; }
+
+  std::string authority() const {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return authority_;
+  }
+
+private:
+  // What one connection needs in nghttp2's callbacks.
+  struct Session {
+    Http2TestServer *server;
+    nghttp2_session *session = nullptr;
+    std::vector<std::int32_t> pending;
+    std::unordered_map<std::int32_t, std::size_t> sent;
+  };
+
+  void Accept() {
+    for (;;) {
+      boost::asio::ip::tcp::socket socket{io_context_};
+      boost::beast::error_code ec;
+      acceptor_.accept(socket, ec);
+      if (stopping_)
+        return;
+      if (ec)
+        continue;
+
+      ++connections_;
+      TestServer::Stream &stream =
+          streams_.emplace_back(std::move(socket), ssl_context_);
+      sessions_.emplace_back([this, &stream] { Serve(stream); });
+    }
+  }
+
+  void Serve(TestServer::Stream &stream) {
+    boost::beast::error_code ec;
+    stream.handshake(boost::asio::ssl::stream_base::server, ec);
+
+    Session session{this, nullptr, {}, {}};
+    nghttp2_session_callbacks *callbacks = nullptr;
+    nghttp2_session_callbacks_new(&callbacks);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, OnHeader);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, OnFrame);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, OnClose);
+    nghttp2_session_server_new(&session.session, callbacks, &session);
+    nghttp2_session_callbacks_del(callbacks);
+    nghttp2_submit_settings(session.session, NGHTTP2_FLAG_NONE, nullptr, 0);
+
+    std::array<std::uint8_t, 16384> buffer;
+    while (!ec) {
+      const std::uint8_t *data = nullptr;
+      for (ssize_t size; (size = nghttp2_session_mem_send(session.session,
+                                                          &data)) > 0;) {
+        boost::asio::write(
+            stream,
+            boost::asio::buffer(data, static_cast<std::size_t>(size)), ec);
+      }
+      if (ec || (!nghttp2_session_want_read(session.session) &&
+                 !nghttp2_session_want_write(session.session)))
+        break;
+
+      const std::size_t size =
+          stream.read_some(boost::asio::buffer(buffer), ec);
+      if (!ec &&
+          nghttp2_session_mem_recv(session.session, buffer.data(), size) < 0)
+        break;
+    }
+
+    nghttp2_session_del(session.session);
+    ::shutdown(stream.next_layer().native_handle(), SHUT_RDWR);
+  }
+
+  static int OnHeader(nghttp2_session *, const nghttp2_frame *,
+                      const std::uint8_t *name, std::size_t name_size,
+                      const std::uint8_t *value, std::size_t value_size,
+                      std::uint8_t, void *user_data) {
+    Http2TestServer &server = *static_cast<Session *>(user_data)->server;
+    if (std::string_view{reinterpret_cast<const char *>(name), name_size} ==
+        ":authority") {
+      std::lock_guard<std::mutex> lock{server.mutex_};
+      server.authority_.assign(reinterpret_cast<const char *>(value),
+                               value_size);
+    }
+    return 0;
+  }
+
+  // Answers once the request is complete and the batch is full.
+  static int OnFrame(nghttp2_session *, const nghttp2_frame *frame,
+                     void *user_data) {
+    Session &session = *static_cast<Session *>(user_data);
+    if ((frame->hd.type != NGHTTP2_HEADERS && frame->hd.type != NGHTTP2_DATA) ||
+        (frame->hd.flags & NGHTTP2_FLAG_END_STREAM) == 0)
+      return 0;
+
+    ++session.server->requests_;
+    session.pending.push_back(frame->hd.stream_id);
+    if (session.pending.size() < session.server->batch_)
+      return 0;
+
+    for (const std::int32_t id : session.pending) {
+      const std::array<nghttp2_nv, 2> fields{{
+          Field(":status", "200"),
+          Field("content-type", "text/event-stream"),
+      }};
+      nghttp2_data_provider body{};
+      body.source.ptr = &session;
+      body.read_callback = ReadBody;
+      nghttp2_submit_response(session.session, id, fields.data(),
+                              fields.size(), &body);
+    }
+    session.pending.clear();
+
+    return 0;
+  }
+
+  static int OnClose(nghttp2_session *, std::int32_t, std::uint32_t error,
+                     void *user_data) {
+    if (error == NGHTTP2_CANCEL)
+      ++static_cast<Session *>(user_data)->server->resets_;
+    return 0;
+  }
+
+  static ssize_t ReadBody(nghttp2_session *, std::int32_t id,
+                          std::uint8_t *buffer, std::size_t length,
+                          std::uint32_t *flags, nghttp2_data_source *source,
+                          void *) {
+    Session &session = *static_cast<Session *>(source->ptr);
+    const std::string &body = session.server->body_;
+
+    std::size_t &sent = session.sent[id];
+    const std::size_t size = std::min(length, body.size() - sent);
+    std::copy_n(body.data() + sent, size, buffer);
+    sent += size;
+
+    if (sent == body.size()) {
+      if (!session.server->end_ && size == 0)
+        return NGHTTP2_ERR_DEFERRED;
+      if (session.server->end_)
+        *flags |= NGHTTP2_DATA_FLAG_EOF;
+    }
+    return static_cast<ssize_t>(size);
+  }
+
+  static nghttp2_nv Field(std::string_view name, std::string_view value) {
+    return {const_cast<std::uint8_t *>(
+                reinterpret_cast<const std::uint8_t *>(name.data())),
+            const_cast<std::uint8_t *>(
+                reinterpret_cast<const std::uint8_t *>(value.data())),
+            name.size(), value.size(), NGHTTP2_NV_FLAG_NONE};
+  }
+
+  const std::size_t batch_;
+  const bool end_;
+  std::string body_;
+  boost::asio::io_context io_context_;
+  boost::asio::ssl::context ssl_context_{
+      boost::asio::ssl::context::tls_server};
+  boost::asio::ip::tcp::acceptor acceptor_;
+  std::list<TestServer::Stream> streams_;
+  std::list<std::thread> sessions_;
+  std::thread thread_;
+  std::atomic<bool> stopping_{false};
+  std::atomic<std::size_t> connections_{0}, requests_{0}, resets_{0};
+  mutable std::mutex mutex_;
+  std::string authority_;
+};
+#endif
+
+// Plain HTTP proxy on a loopback port that accepts one CONNECT and relays
+// the tunnel to `port` on the loopback interface.
+class TestProxy {
+public:
+  explicit TestProxy(unsigned short port)
+      : acceptor_{io_context_,
+                  {boost::asio::ip::make_address("127.0.0.1"), 0}} {
+    thread_ = std::thread{[this, port] { Serve(port); }};
+  }
+
+  TestProxy(const TestProxy &) = delete;
+  TestProxy &operator=(const TestProxy &) = delete;
+
+  ~TestProxy() {
+    if (!accepted_) {
+      boost::beast::error_code ec;
+      boost::asio::ip::tcp::socket wake{io_context_};
+      wake.connect(acceptor_.local_endpoint(), ec);
+    }
+
+    // The client may keep its pooled connection open past the test.
+    ::shutdown(client_.native_handle(), SHUT_RDWR);
+    ::shutdown(server_.native_handle(), SHUT_RDWR);
+    thread_.join();
+  }
+
+  std::string Address() const {
+    return "http://127.0.0.1:" +
+           std::to_string(acceptor_.local_endpoint().port());
+  }
+
+  std::string target() const {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return target_;
+  }
+
+  std::string authorization() const {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return authorization_;
+  }
+
+private:
+  void Serve(unsigned short port) {
+    boost::beast::error_code ec;
+    acceptor_.accept(client_, ec);
+    accepted_ = true;
+    if (ec)
+      return;
+
+    boost::beast::flat_buffer buffer;
+    boost::beast::http::request<boost::beast::http::empty_body> request;
+    boost::beast::http::read(client_, buffer, request, ec);
+    if (ec)
+      return;
+
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      target_ = std::string{request.target()};
+      authorization_ =
+          std::string{request[boost::beast::http::field::proxy_authorization]};
+    }
+
+    server_.connect({boost::asio::ip::make_address("127.0.0.1"), port}, ec);
+    if (ec)
+      return;
+    boost::asio::write(
+        client_,
+        boost::asio::buffer(std::string_view{"HTTP/1.1 200 OK\r\n\r\n"}),
+        ec);
+
+    std::thread upstream{[this] { Relay(client_, server_); }};
+    Relay(server_, client_);
+    upstream.join();
+  }
+
+  // Copies until `from` ends, then ends `to` as well.
+  static void Relay(boost::asio::ip::tcp::socket &from,
+                    boost::asio::ip::tcp::socket &to) {
+    std::array<char, 4096> data;
+    boost::beast::error_code ec;
+    for (;;) {
+      const std::size_t size = from.read_some(boost::asio::buffer(data), ec);
+      if (ec)
+        break;
+      boost::asio::write(to, boost::asio::buffer(data.data(), size), ec);
+      if (ec)
+        break;
+    }
+    ::shutdown(to.native_handle(), SHUT_WR);
+  }
+
+  boost::asio::io_context io_context_;
+  boost::asio::ip::tcp::acceptor acceptor_;
+  boost::asio::ip::tcp::socket client_{io_context_}, server_{io_context_};
+  std::thread thread_;
+  std::atomic<bool> accepted_{false};
+  mutable std::mutex mutex_;
+  std::string target_, authorization_;
+};
+
+// Compresses `data` with the gzip framing, or the zlib one for deflate.
+std::string Compress(std::string_view data, bool gzip) {
+  z_stream stream{};
+  deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, gzip ? 31 : 15, 8,
+               Z_DEFAULT_STRATEGY);
+
+  std::string out(deflateBound(&stream, static_cast<uLong>(data.size())), '\0');
+  stream.next_in =
+      reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+  stream.avail_in = static_cast<uInt>(data.size());
+  stream.next_out = reinterpret_cast<Bytef *>(out.data());
+  stream.avail_out = static_cast<uInt>(out.size());
+  deflate(&stream, Z_FINISH);
+  out.resize(stream.total_out);
+  deflateEnd(&stream);
+
+  return out;
+}
+
+std::string Decompress(std::string_view data) {
+  z_stream stream{};
+  inflateInit2(&stream, 15 + 32);
+
+  std::string out;
+  std::array<char, 4096> chunk;
+  stream.next_in =
+      reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+  stream.avail_in = static_cast<uInt>(data.size());
+  int result = Z_OK;
+  while (result == Z_OK) {
+    stream.next_out = reinterpret_cast<Bytef *>(chunk.data());
+    stream.avail_out = static_cast<uInt>(chunk.size());
+    result = inflate(&stream, Z_NO_FLUSH);
+    out.append(chunk.data(), chunk.size() - stream.avail_out);
+  }
+  inflateEnd(&stream);
+
+  return result == Z_STREAM_END ? out : std::string{};
+}
+
+// Answers with an event stream, one chunk per event.
+bool SendEvents(TestServer::Stream &stream, const TestServer::Request &request,
+                const std::vector<std::string> &events) {
+  std::string response = "HTTP/1.1 200 OK\r\n"
+                         "Content-Type: text/event-stream\r\n"
+                         "Transfer-Encoding: chunked\r\n";
+  if (!request.keep_alive())
+    response += "Connection: close\r\n";
+  response += "\r\n";
+
+  for (const std::string &event : events) {
+    const std::string data = "data: " + event + "\n\n";
+    std::ostringstream chunk;
+    chunk << std::hex << data.size() << "\r\n" << data << "\r\n";
+    response += chunk.str();
+  }
+  response += "0\r\n\r\n";
+
+  boost::beast::error_code ec;
+  boost::asio::write(stream, boost::asio::buffer(response), ec);
+  return !ec && request.keep_alive();
+}
+
+} // namespace
+
 TEST(XaiTest, Connect) {
   std::thread server{ServerRun};
 
@@ -91,3 +631,858 @@ TEST(XaiTest, Connect) {
 
   EXPECT_EQ(choices->first(), "foo content");
 }
+
+TEST(PoolTest, ReusesConnections) {
+  TestServer server{[](const auto &request, auto &stream) {
+    return Reply(stream, request);
+  }};
+
+  auto client = xai::Client::Make("foo_key", "localhost", server.Options());
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(client->ChatCompletion(messages)->first(), "foo content");
+  }
+
+  EXPECT_EQ(server.connections(), 1u);
+  EXPECT_EQ(server.requests(), 3u);
+}
+
+TEST(PoolTest, BoundedByMax) {
+  TestServer server{[](const auto &request, auto &stream) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{5});
+    return Reply(stream, request);
+  }};
+
+  xai::Client::Options options = server.Options();
+  options.pool_max = 2;
+  auto client = xai::Client::Make("foo_key", "localhost", options);
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&client] {
+      auto messages = xai::Messages::Make("test");
+      messages->AddU("hello");
+      for (int j = 0; j < 5; ++j) {
+        EXPECT_EQ(client->ChatCompletion(messages)->first(), "foo content");
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_LE(server.connections(), 2u);
+  EXPECT_EQ(server.requests(), 20u);
+}
+
+TEST(PoolTest, ZeroIdleTimeoutKeepsConnections) {
+  TestServer server{[](const auto &request, auto &stream) {
+    return Reply(stream, request);
+  }};
+
+  xai::Client::Options options = server.Options();
+  options.idle_timeout = std::chrono::seconds{0};
+  auto client = xai::Client::Make("foo_key", "localhost", options);
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  for (int i = 0; i < 3; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{20});
+    EXPECT_EQ(client->ChatCompletion(messages)->first(), "foo content");
+  }
+
+  EXPECT_EQ(server.connections(), 1u);
+}
+
+TEST(PoolTest, OpensForAsyncCallersOnTheExecutor) {
+  TestServer server{[](const auto &request, auto &stream) {
+    return Reply(stream, request);
+  }};
+
+  xai::Client::Options options = server.Options();
+  options.pool_min = 0;
+  options.pool_max = 2;
+  boost::asio::io_context io_context;
+  auto client = xai::Client::Make("foo_key", "localhost", options,
+                                  io_context.get_executor());
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  int done = 0;
+  for (int i = 0; i < 4; ++i) {
+    client->AsyncChatCompletion(
+        messages, [&done](std::exception_ptr error,
+                          std::unique_ptr<xai::Choices> choices) {
+          EXPECT_FALSE(error);
+          if (choices) {
+            EXPECT_EQ(choices->first(), "foo content");
+          }
+          ++done;
+        });
+  }
+  io_context.run();
+
+  EXPECT_EQ(done, 4);
+  EXPECT_LE(server.connections(), 2u);
+  EXPECT_EQ(server.requests(), 4u);
+}
+
+TEST(RetryTest, ReconnectsAfterServerClose) {
+  TestServer server{[](const auto &request, auto &stream) {
+    Reply(stream, request);
+    return false;
+  }};
+
+  auto client = xai::Client::Make("foo_key", "localhost", server.Options());
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_EQ(client->ChatCompletion(messages)->first(), "foo content");
+    std::this_thread::sleep_for(std::chrono::milliseconds{50});
+  }
+
+  EXPECT_EQ(server.connections(), 2u);
+}
+
+TEST(RetryTest, RetriesGetOnReusedConnection) {
+  std::atomic<int> count{0};
+  TestServer server{[&count](const auto &request, auto &stream) {
+    // The second request finds its connection dropped without an answer.
+    if (++count == 2)
+      return false;
+    return Reply(stream, request, R"({"data":[{"id":"grok"}]})");
+  }};
+
+  auto client = xai::Client::Make("foo_key", "localhost", server.Options());
+
+  for (int i = 0; i < 2; ++i) {
+    std::vector<std::string> ids;
+    client->ListModels()->Traverse([&ids](const auto &model) {
+      ids.emplace_back(model.id);
+    });
+    EXPECT_EQ(ids, std::vector<std::string>{"grok"});
+  }
+
+  EXPECT_EQ(server.connections(), 2u);
+  EXPECT_EQ(server.requests(), 3u);
+}
+
+TEST(RetryTest, DoesNotRetryPost) {
+  std::atomic<int> count{0};
+  TestServer server{[&count](const auto &request, auto &stream) {
+    if (++count == 2)
+      return false;
+    return Reply(stream, request);
+  }};
+
+  auto client = xai::Client::Make("foo_key", "localhost", server.Options());
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  EXPECT_EQ(client->ChatCompletion(messages)->first(), "foo content");
+  EXPECT_THROW(client->ChatCompletion(messages), std::exception);
+  EXPECT_EQ(server.requests(), 2u);
+}
+
+TEST(SessionTest, ResumesPerTrustConfiguration) {
+  TestServer server{[](const auto &request, auto &stream) {
+    return Reply(stream, request);
+  }};
+
+  const xai::Client::Options options = server.Options();
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  for (int i = 0; i < 2; ++i) {
+    auto client = xai::Client::Make("foo_key", "localhost", options);
+    EXPECT_EQ(client->ChatCompletion(messages)->first(), "foo content");
+  }
+  EXPECT_EQ(server.resumed(), 1u);
+
+  // The same server trusted through another CA file gets a full handshake.
+  xai::Client::Options other = options;
+  other.ca_file += ".copy";
+  std::filesystem::copy_file(
+      options.ca_file, other.ca_file,
+      std::filesystem::copy_options::overwrite_existing);
+
+  auto client = xai::Client::Make("foo_key", "localhost", other);
+  EXPECT_EQ(client->ChatCompletion(messages)->first(), "foo content");
+  EXPECT_EQ(server.resumed(), 1u);
+}
+
+TEST(SessionTest, SavesSessionFile) {
+  TestServer server{[](const auto &request, auto &stream) {
+    return Reply(stream, request);
+  }};
+
+  const std::filesystem::path path =
+      std::filesystem::temp_directory_path() / "xai-test-sessions.pem";
+  std::filesystem::remove(path);
+
+  xai::Client::Options options = server.Options();
+  options.session_file = path.string();
+  auto client = xai::Client::Make("foo_key", "localhost", options);
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+  EXPECT_EQ(client->ChatCompletion(messages)->first(), "foo content");
+
+  // The file is written in the background, and holds the sessions of every
+  // client in the process.
+  const std::string key = "localhost:" + options.port + ' ' + options.ca_file;
+  bool saved = false;
+  for (int i = 0; i < 100 && !saved; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    std::ifstream file{path};
+    for (std::string line; !saved && std::getline(file, line);) {
+      saved = line == key;
+    }
+  }
+  EXPECT_TRUE(saved);
+}
+
+// Answers with the content of the last message in the request, so responses
+// can be matched to requests.
+bool Echo(TestServer::Stream &stream, const TestServer::Request &request) {
+  const std::string_view body = request.body();
+  const std::string_view field = "\"content\":\"";
+  const std::size_t begin = body.rfind(field) + field.size();
+  const std::string_view content =
+      body.substr(begin, body.find('"', begin) - begin);
+
+  return Reply(stream, request,
+               R"({"choices":[{"message":{"content":")" + std::string{content} +
+                   R"("}}]})");
+}
+
+// A batch of conversations whose answers tell them apart.
+std::vector<std::unique_ptr<xai::Messages>> Batch(std::size_t size) {
+  std::vector<std::unique_ptr<xai::Messages>> batch;
+  for (std::size_t i = 0; i < size; ++i) {
+    auto messages = xai::Messages::Make("test");
+    messages->AddU(("m" + std::to_string(i)).c_str());
+    batch.push_back(std::move(messages));
+  }
+  return batch;
+}
+
+TEST(PipelineTest, KeepsOrder) {
+  TestServer server{[](const auto &request, auto &stream) {
+    return Echo(stream, request);
+  }};
+
+  xai::Client::Options options = server.Options();
+  options.pipeline_depth = 3;
+  auto client = xai::Client::Make("foo_key", "localhost", options);
+
+  const auto batch = Batch(7);
+  const auto choices = client->ChatCompletion(batch);
+
+  ASSERT_EQ(choices.size(), batch.size());
+  for (std::size_t i = 0; i < choices.size(); ++i) {
+    EXPECT_EQ(choices[i]->first(), "m" + std::to_string(i));
+  }
+  EXPECT_EQ(server.connections(), 1u);
+  EXPECT_EQ(server.requests(), batch.size());
+}
+
+TEST(PipelineTest, ResendsAfterServerClose) {
+  // Each connection answers two requests and then closes without saying so.
+  TestServer server{[](const auto &request, auto &stream) {
+    static thread_local int answered = 0;
+    Echo(stream, request);
+    return ++answered < 2;
+  }};
+
+  xai::Client::Options options = server.Options();
+  options.pipeline_depth = 3;
+  auto client = xai::Client::Make("foo_key", "localhost", options);
+
+  const auto batch = Batch(6);
+  const auto choices = client->ChatCompletion(batch);
+
+  ASSERT_EQ(choices.size(), batch.size());
+  for (std::size_t i = 0; i < choices.size(); ++i) {
+    EXPECT_EQ(choices[i]->first(), "m" + std::to_string(i));
+  }
+  EXPECT_EQ(server.connections(), 3u);
+}
+
+// Whether `call` throws a timeout error.
+bool TimesOut(const std::function<void()> &call) {
+  try {
+    call();
+  } catch (const boost::beast::system_error &e) {
+    return e.code() == boost::beast::error::timeout;
+  }
+  return false;
+}
+
+TEST(TimeoutTest, Request) {
+  TestServer server{[](const auto &request, auto &stream) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{500});
+    return Reply(stream, request);
+  }};
+
+  xai::Client::Options options = server.Options();
+  options.request_timeout = std::chrono::milliseconds{100};
+  auto client = xai::Client::Make("foo_key", "localhost", options);
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  EXPECT_TRUE(TimesOut([&] { (void)client->ChatCompletion(messages); }));
+}
+
+TEST(TimeoutTest, FirstByte) {
+  TestServer server{[](const auto &request, auto &stream) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{500});
+    return SendEvents(stream, request, {"[DONE]"});
+  }};
+
+  xai::Client::Options options = server.Options();
+  options.first_byte_timeout = std::chrono::milliseconds{100};
+  auto client = xai::Client::Make("foo_key", "localhost", options);
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  EXPECT_TRUE(TimesOut([&] {
+    client->StreamChatCompletion(messages, [](const xai::Delta &) {});
+  }));
+}
+
+TEST(TimeoutTest, BetweenReads) {
+  TestServer server{[](const auto &request, auto &stream) {
+    const std::string head = "HTTP/1.1 200 OK\r\n"
+                             "Content-Type: text/event-stream\r\n"
+                             "Transfer-Encoding: chunked\r\n\r\n";
+    const std::string event =
+        "data: {\"choices\":[{\"delta\":{\"content\":\"foo\"}}]}\n\n";
+    std::ostringstream chunk;
+    chunk << std::hex << event.size() << "\r\n" << event << "\r\n";
+
+    boost::beast::error_code ec;
+    boost::asio::write(stream, boost::asio::buffer(head + chunk.str()), ec);
+    std::this_thread::sleep_for(std::chrono::milliseconds{500});
+    return SendEvents(stream, request, {});
+  }};
+
+  xai::Client::Options options = server.Options();
+  options.read_timeout = std::chrono::milliseconds{100};
+  auto client = xai::Client::Make("foo_key", "localhost", options);
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  std::string content;
+  EXPECT_TRUE(TimesOut([&] {
+    client->StreamChatCompletion(
+        messages, [&](const xai::Delta &delta) { content += delta.content; });
+  }));
+  EXPECT_EQ(content, "foo");
+}
+
+TEST(TimeoutTest, SparesRecycledConnection) {
+  TestServer server{[](const auto &request, auto &stream) {
+    return Reply(stream, request);
+  }};
+
+  xai::Client::Options options = server.Options();
+  options.request_timeout = std::chrono::milliseconds{100};
+  options.first_byte_timeout = std::chrono::milliseconds{100};
+  options.read_timeout = std::chrono::milliseconds{100};
+  auto client = xai::Client::Make("foo_key", "localhost", options);
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(client->ChatCompletion(messages)->first(), "foo content");
+    std::this_thread::sleep_for(std::chrono::milliseconds{200});
+  }
+
+  EXPECT_EQ(server.connections(), 1u);
+}
+
+TEST(StopTest, StopsMidStream) {
+  TestServer server{[](const auto &, auto &stream) {
+    const std::string event =
+        "data: {\"choices\":[{\"delta\":{\"content\":\"foo\"}}]}\n\n";
+    std::ostringstream response;
+    response << "HTTP/1.1 200 OK\r\n"
+                "Content-Type: text/event-stream\r\n"
+                "Transfer-Encoding: chunked\r\n\r\n"
+             << std::hex << event.size() << "\r\n"
+             << event << "\r\n";
+
+    // Holds the stream open until the client hangs up.
+    boost::beast::error_code ec;
+    boost::asio::write(stream, boost::asio::buffer(response.str()), ec);
+    char byte;
+    while (!ec) {
+      stream.read_some(boost::asio::buffer(&byte, 1), ec);
+    }
+    return false;
+  }};
+
+  auto client = xai::Client::Make("foo_key", "localhost", server.Options());
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  std::stop_source source;
+  std::atomic<int> events = 0;
+  std::jthread stopper{[&] {
+    while (events == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+    source.request_stop();
+  }};
+
+  const auto start = std::chrono::steady_clock::now();
+  client->ChatCompletion(
+      messages, [&](std::unique_ptr<xai::Choices>) { ++events; },
+      source.get_token());
+
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds{1});
+  EXPECT_EQ(events, 1);
+}
+
+TEST(GzipTest, InflatesResponses) {
+  for (const bool gzip : {true, false}) {
+    TestServer server{[gzip](const auto &request, auto &stream) {
+      boost::beast::http::response<boost::beast::http::string_body> response{
+          boost::beast::http::status::ok, request.version()};
+      response.set(boost::beast::http::field::content_type,
+                   "application/json");
+      response.set(boost::beast::http::field::content_encoding,
+                   gzip ? "gzip" : "deflate");
+      response.body() = Compress(completion, gzip);
+      response.prepare_payload();
+
+      boost::beast::error_code ec;
+      boost::beast::http::write(stream, response, ec);
+      return !ec && request.keep_alive();
+    }};
+
+    auto client = xai::Client::Make("foo_key", "localhost", server.Options());
+    auto messages = xai::Messages::Make("test");
+    messages->AddU("hello");
+
+    EXPECT_EQ(client->ChatCompletion(messages)->first(), "foo content")
+        << (gzip ? "gzip" : "deflate");
+  }
+}
+
+TEST(GzipTest, CompressesLargeRequests) {
+  std::mutex mutex;
+  std::vector<std::pair<std::string, std::string>> bodies;
+  TestServer server{[&](const auto &request, auto &stream) {
+    const std::string encoding{
+        request[boost::beast::http::field::content_encoding]};
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      bodies.emplace_back(encoding, encoding == "gzip"
+                                        ? Decompress(request.body())
+                                        : request.body());
+    }
+    return Reply(stream, request);
+  }};
+
+  xai::Client::Options options = server.Options();
+  options.compress_threshold = 1024;
+  auto client = xai::Client::Make("foo_key", "localhost", options);
+
+  const std::string large(4096, 'x');
+  for (const std::string &content : {std::string{"hello"}, large}) {
+    auto messages = xai::Messages::Make("test");
+    messages->AddU(content.c_str());
+    EXPECT_EQ(client->ChatCompletion(messages)->first(), "foo content");
+  }
+
+  ASSERT_EQ(bodies.size(), 2u);
+  EXPECT_EQ(bodies[0].first, "");
+  EXPECT_NE(bodies[0].second.find("\"hello\""), std::string::npos);
+  EXPECT_EQ(bodies[1].first, "gzip");
+  EXPECT_NE(bodies[1].second.find(large), std::string::npos);
+}
+
+TEST(ProxyTest, TunnelsThroughConnect) {
+  TestServer server{[](const auto &request, auto &stream) {
+    return Reply(stream, request);
+  }};
+  TestProxy proxy{server.port()};
+
+  xai::Client::Options options = server.Options();
+  options.proxy = proxy.Address();
+  options.proxy_authorization = "Basic Zm9vOmJhcg==";
+  auto client = xai::Client::Make("foo_key", "localhost", options);
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_EQ(client->ChatCompletion(messages)->first(), "foo content");
+  }
+
+  EXPECT_EQ(proxy.target(), "localhost:" + std::to_string(server.port()));
+  EXPECT_EQ(proxy.authorization(), "Basic Zm9vOmJhcg==");
+  EXPECT_EQ(server.connections(), 1u);
+}
+
+TEST(Http2Test, FallsBackToHttp1) {
+  TestServer server{[](const auto &request, auto &stream) {
+    return SendEvents(stream, request,
+                      {R"({"choices":[{"delta":{"content":"foo"}}]})",
+                       "[DONE]"});
+  }};
+
+  xai::Client::Options options = server.Options();
+  options.http2 = true;
+  auto client = xai::Client::Make("foo_key", "localhost", options);
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  std::size_t connections = 0;
+  for (int i = 0; i < 2; ++i) {
+    std::string content;
+    client->StreamChatCompletion(
+        messages, [&](const xai::Delta &delta) { content += delta.content; });
+    EXPECT_EQ(content, "foo");
+
+    // The server is only asked about HTTP/2 once.
+    if (i == 0)
+      connections = server.connections();
+  }
+
+  EXPECT_EQ(server.connections(), connections);
+  EXPECT_EQ(server.requests(), 2u);
+}
+
+#ifdef XAI_HTTP2
+TEST(Http2Test, MultiplexesStreams) {
+  // Nothing is answered before all four requests are open at once.
+  Http2TestServer server{
+      {R"({"choices":[{"delta":{"content":"foo"}}]})", "[DONE]"}, 4};
+
+  xai::Client::Options options = server.Options();
+  options.http2 = true;
+  options.pool_min = 0;
+  options.request_timeout = std::chrono::seconds{5};
+  auto client = xai::Client::Make("foo_key", "localhost", options);
+
+  std::vector<std::thread> threads;
+  std::atomic<int> done = 0;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&] {
+      auto messages = xai::Messages::Make("test");
+      messages->AddU("hello");
+
+      std::string content;
+      client->StreamChatCompletion(
+          messages, [&](const xai::Delta &delta) { content += delta.content; });
+      if (content == "foo")
+        ++done;
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(done, 4);
+  EXPECT_EQ(server.connections(), 1u);
+  EXPECT_EQ(server.requests(), 4u);
+  EXPECT_EQ(server.authority(), "localhost:" + server.Options().port);
+}
+
+TEST(Http2Test, OpensWindowsAsDataIsConsumed) {
+  Http2TestServer server{std::vector<std::string>(
+      300, R"({"choices":[{"delta":{"content":"x"}}]})")};
+
+  xai::Client::Options options = server.Options();
+  options.http2 = true;
+  options.http2_stream_window = 1024;
+  options.request_timeout = std::chrono::seconds{5};
+  auto client = xai::Client::Make("foo_key", "localhost", options);
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  std::size_t deltas = 0;
+  client->StreamChatCompletion(messages,
+                               [&](const xai::Delta &) { ++deltas; });
+
+  EXPECT_EQ(deltas, 300u);
+}
+
+TEST(Http2Test, StopResetsTheStream) {
+  Http2TestServer server{{R"({"choices":[{"delta":{"content":"foo"}}]})"},
+                         1, false};
+
+  xai::Client::Options options = server.Options();
+  options.http2 = true;
+  auto client = xai::Client::Make("foo_key", "localhost", options);
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  std::stop_source source;
+  client->StreamChatCompletion(
+      messages, [&](const xai::Delta &) { source.request_stop(); },
+      source.get_token());
+
+  for (int i = 0; i < 100 && server.resets() == 0; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+  }
+  EXPECT_EQ(server.resets(), 1u);
+}
+
+TEST(Http2Test, TimeoutOnlyResetsItsStream) {
+  Http2TestServer server{{R"({"choices":[{"delta":{"content":"foo"}}]})"},
+                         1, false};
+
+  xai::Client::Options options = server.Options();
+  options.http2 = true;
+  options.pool_min = 0;
+  options.read_timeout = std::chrono::milliseconds{100};
+  auto client = xai::Client::Make("foo_key", "localhost", options);
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_TRUE(TimesOut([&] {
+      client->StreamChatCompletion(messages, [](const xai::Delta &) {});
+    }));
+  }
+
+  for (int i = 0; i < 100 && server.resets() < 2; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+  }
+  EXPECT_EQ(server.resets(), 2u);
+  EXPECT_EQ(server.connections(), 1u);
+}
+#endif
+
+TEST(HedgeTest, BlockingCallFromExecutorThread) {
+  TestServer server{[](const auto &request, auto &stream) {
+    return Reply(stream, request);
+  }};
+
+  xai::Client::Options options = server.Options();
+  options.hedge_percentile = 50;
+  options.hedge_min_samples = 1;
+  boost::asio::io_context io_context;
+  auto client = xai::Client::Make("foo_key", "localhost", options,
+                                  io_context.get_executor());
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  int done = 0;
+  boost::asio::post(io_context, [&] {
+    for (; done < 3; ++done) {
+      EXPECT_EQ(client->ChatCompletion(messages)->first(), "foo content");
+    }
+  });
+  io_context.run();
+
+  EXPECT_EQ(done, 3);
+}
+
+TEST(HostTest, CarriesNonDefaultPort) {
+  std::string host;
+  TestServer server{[&host](const auto &request, auto &stream) {
+    host = std::string{request[boost::beast::http::field::host]};
+    return Reply(stream, request);
+  }};
+
+  auto client = xai::Client::Make("foo_key", "localhost", server.Options());
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+  EXPECT_EQ(client->ChatCompletion(messages)->first(), "foo content");
+
+  EXPECT_EQ(host, "localhost:" + std::to_string(server.port()));
+}
+
+TEST(DeltaTest, ThrowsOnErrorEvent) {
+  TestServer server{[](const auto &request, auto &stream) {
+    return SendEvents(stream, request,
+                      {R"({"choices":[{"delta":{"content":"foo"}}]})",
+                       R"({"error":{"message":"overloaded"}})"});
+  }};
+
+  auto client = xai::Client::Make("foo_key", "localhost", server.Options());
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  std::string content, error;
+  try {
+    client->StreamChatCompletion(
+        messages, [&](const xai::Delta &delta) { content += delta.content; });
+  } catch (const std::exception &e) {
+    error = e.what();
+  }
+
+  EXPECT_EQ(content, "foo");
+  EXPECT_NE(error.find("overloaded"), std::string::npos) << error;
+}
+
+TEST(DeltaTest, MissingDeltaIsEmpty) {
+  TestServer server{[](const auto &request, auto &stream) {
+    return SendEvents(stream, request,
+                      {R"({"choices":[{"delta":{"content":"foo"}}]})",
+                       R"({"choices":[{"finish_reason":"stop"}]})",
+                       "[DONE]"});
+  }};
+
+  auto client = xai::Client::Make("foo_key", "localhost", server.Options());
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  std::vector<std::pair<std::string, std::string>> deltas;
+  client->StreamChatCompletion(messages, [&](const xai::Delta &delta) {
+    deltas.emplace_back(delta.content, delta.finish_reason);
+  });
+
+  EXPECT_EQ(deltas, (std::vector<std::pair<std::string, std::string>>{
+                        {"foo", ""}, {"", "stop"}}));
+}
+
+TEST(DeltaStreamTest, Iterates) {
+  TestServer server{[](const auto &request, auto &stream) {
+    return SendEvents(stream, request,
+                      {R"({"choices":[{"delta":{"content":"foo"}}]})",
+                       R"({"choices":[{"delta":{"content":"bar"}}]})",
+                       "[DONE]"});
+  }};
+
+  auto client = xai::Client::Make("foo_key", "localhost", server.Options());
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  for (int i = 0; i < 2; ++i) {
+    std::string content;
+    auto stream = client->StreamChatCompletion(messages);
+    for (const xai::Delta &delta : *stream) {
+      content += delta.content;
+    }
+    EXPECT_EQ(content, "foobar");
+    EXPECT_EQ(stream->Next(), nullptr);
+  }
+
+  EXPECT_EQ(server.connections(), 1u);
+}
+
+TEST(DeltaStreamTest, EarlyDestructionClosesConnection) {
+  std::atomic<int> count = 0;
+  TestServer server{[&count](const auto &request, auto &stream) {
+    if (count++ > 0)
+      return Reply(stream, request);
+    return SendEvents(
+        stream, request,
+        std::vector<std::string>(
+            1000, R"({"choices":[{"delta":{"content":"foo"}}]})"));
+  }};
+
+  auto client = xai::Client::Make("foo_key", "localhost", server.Options());
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  {
+    auto stream = client->StreamChatCompletion(messages);
+    const xai::Delta *delta = stream->Next();
+    ASSERT_NE(delta, nullptr);
+    EXPECT_EQ(delta->content, "foo");
+  }
+
+  EXPECT_EQ(client->ChatCompletion(messages)->first(), "foo content");
+  EXPECT_EQ(server.connections(), 2u);
+}
+
+TEST(DeltaStreamTest, FinishesAfterError) {
+  TestServer server{[](const auto &request, auto &stream) {
+    return SendEvents(stream, request,
+                      {R"({"choices":[{"delta":{"content":"foo"}}]})",
+                       R"({"error":{"message":"overloaded"}})",
+                       R"({"choices":[{"delta":{"content":"bar"}}]})"});
+  }};
+
+  auto client = xai::Client::Make("foo_key", "localhost", server.Options());
+  auto messages = xai::Messages::Make("test");
+  messages->AddU("hello");
+
+  auto stream = client->StreamChatCompletion(messages);
+  const xai::Delta *delta = stream->Next();
+  ASSERT_NE(delta, nullptr);
+  EXPECT_EQ(delta->content, "foo");
+  EXPECT_THROW((void)stream->Next(), std::exception);
+  EXPECT_EQ(stream->Next(), nullptr);
+}
+
+TEST(SseTest, SplitEvents) {
+  const std::string stream = ": keep-alive\r\n"
+                             "data: {\"a\":1}\r\n\r\n"
+                             "event: delta\n"
+                             "data: first\r\n"
+                             "data:second\n\n"
+                             "data: [DONE]\r\r";
+
+  // Every way of splitting the stream in two yields the same events.
+  for (std::size_t split = 0; split <= stream.size(); ++split) {
+    sse::Decoder decoder;
+    std::vector<std::string> events;
+    const auto event = [&](std::string_view data) {
+      events.emplace_back(data);
+    };
+
+    decoder.Feed(std::string_view{stream}.substr(0, split), event);
+    decoder.Feed(std::string_view{stream}.substr(split), event);
+
+    EXPECT_EQ(events, (std::vector<std::string>{"{\"a\":1}",
+                                                 "first\nsecond", "[DONE]"}))
+        << "split at " << split;
+  }
+
+  // So does every way of splitting it in three, including with an empty
+  // middle piece.
+  for (std::size_t first = 0; first <= stream.size(); ++first) {
+    for (std::size_t second = first; second <= stream.size(); ++second) {
+      sse::Decoder decoder;
+      std::vector<std::string> events;
+      const auto event = [&](std::string_view data) {
+        events.emplace_back(data);
+      };
+
+      const std::string_view view{stream};
+      decoder.Feed(view.substr(0, first), event);
+      decoder.Feed(view.substr(first, second - first), event);
+      decoder.Feed(view.substr(second), event);
+
+      EXPECT_EQ(events, (std::vector<std::string>{"{\"a\":1}",
+                                                   "first\nsecond", "[DONE]"}))
+          << "split at " << first << " and " << second;
+    }
+  }
+}
+
+TEST(SseTest, ExtractDelta) {
+  xai::Delta delta;
+  std::string scratch;
+
+  ASSERT_TRUE(sse::ExtractDelta(
+      R"({"id":"1","choices":[{"index":0,"delta":{"role":"assistant",)"
+      R"("content":"Hi"},"finish_reason":null}],"usage":{"a":[1,{}]}})",
+      delta, scratch));
+  EXPECT_EQ(delta.content, "Hi");
+  EXPECT_EQ(delta.role, "assistant");
+  EXPECT_EQ(delta.finish_reason, "");
+
+  ASSERT_TRUE(sse::ExtractDelta(
+      R"({"choices":[{"delta":{"content":"a\"b\n\u00e9\ud83d\ude00"},)"
+      R"("finish_reason":"stop"}]})",
+      delta, scratch));
+  EXPECT_EQ(delta.content, "a\"b\né\U0001F600");
+  EXPECT_EQ(delta.finish_reason, "stop");
+
+  // Tool calls and errors are left to the full parser.
+  EXPECT_FALSE(sse::ExtractDelta(
+      R"({"choices":[{"delta":{"tool_calls":[{"id":"call_1"}]}}]})", delta,
+      scratch));
+  EXPECT_FALSE(sse::ExtractDelta(R"({"error":{"message":"overloaded"}})",
+                                 delta, scratch));
+}
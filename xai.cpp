@@ -1,11 +1,63 @@
 #include "xai.hpp"
 
+#include <boost/asio/append.hpp>
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/compose.hpp>
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/redirect_error.hpp>
 #include <boost/asio/ssl.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/use_future.hpp>
+#include <boost/asio/write.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/core/tcp_stream.hpp>
 #include <boost/beast/http.hpp>
+#include <boost/beast/zlib/error.hpp>
 #include <boost/json.hpp>
 
+#include <openssl/pem.h>
+
+#include <zlib.h>
+
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "sse.hpp"
+
+#ifdef XAI_HTTP2
+#include <nghttp2/nghttp2.h>
+#endif
+
 #ifdef XAI_CERT_DEV
 #include "dev.hpp"
 #endif
@@ -44,6 +96,15 @@ public:
   boost::json::object object_;
 };
 
+class xAITextChoices : public xai::Choices {
+public:
+  explicit xAITextChoices(std::string &&text) : text_{std::move(text)} {}
+
+  std::string_view first() final { return text_; }
+
+  std::string text_;
+};
+
 class xAIMessages final : public xai::Messages {
 public:
   explicit xAIMessages(const char *model) : model_{model} {}
@@ -102,217 +163,3597 @@ private:
 
 struct Server {
   static constexpr int version = 11;
-  static constexpr const char *port = "443", *user_agent = "xaicpp/0.1",
-                              *content_type = "application/json";
+  static constexpr const char *user_agent = "xaicpp/0.1",
+                              *content_type = "application/json",
+                              *accept_encoding = "gzip, deflate";
+  static constexpr unsigned char alpn[] = "\x08http/1.1";
+  static constexpr unsigned char alpn_h2[] = "\x02h2\x08http/1.1";
 };
 
 static constexpr const char *default_host = "api.x.ai";
 
-class xAIClient final : public xai::Client {
+// TLS sessions of every client in the process, keyed by server and trust
+// configuration so that a session is only resumed where it was established.
+// With a session file, new tickets are written out by a thread of their own
+// instead of the connection that received them.
+class SessionCache {
+public:
+  static SessionCache &Instance() {
+    static SessionCache &cache = *new SessionCache;
+    return cache;
+  }
+
+  void Attach(SSL_CTX *ctx) {
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT |
+                                            SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, &SessionCache::OnNewSession);
+  }
+
+  void Persist(const std::string &path) {
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    if (path == path_)
+      return;
+
+    path_ = path;
+    Load();
+
+    if (!writer_.joinable()) {
+      writer_ = std::jthread{[this](std::stop_token stop) { Write(stop); }};
+      std::atexit([] { Instance().Save(); });
+    }
+  }
+
+  void Resume(SSL *ssl, const std::string &host,
+              const xai::Client::Options &options) {
+    std::string key = host + ':' + options.port;
+    if (!options.ca_file.empty())
+      key.append(" ").append(options.ca_file);
+
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+
+      auto it = sessions_.find(key);
+      if (it != sessions_.end() && Resumable(it->second.get()))
+        SSL_set_session(ssl, it->second.get());
+    }
+
+    SSL_set_ex_data(ssl, index_, new std::string{std::move(key)});
+  }
+
+private:
+  struct SessionFree {
+    void operator()(SSL_SESSION *session) const { SSL_SESSION_free(session); }
+  };
+
+  using Session = std::unique_ptr<SSL_SESSION, SessionFree>;
+
+  SessionCache()
+      : index_{SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, &FreeKey)} {}
+
+  static void FreeKey(void *, void *key, CRYPTO_EX_DATA *, int, long,
+                      void *) {
+    delete static_cast<std::string *>(key);
+  }
+
+  static int OnNewSession(SSL *ssl, SSL_SESSION *session) {
+    SessionCache &cache = Instance();
+
+    const auto *key =
+        static_cast<const std::string *>(SSL_get_ex_data(ssl, cache.index_));
+    if (key == nullptr)
+      return 0;
+
+    // A copy, since OpenSSL marks the connection's own session as not
+    // resumable when the connection is dropped without a TLS shutdown.
+    Session copy{SSL_SESSION_dup(session)};
+    if (!copy)
+      return 0;
+
+    {
+      std::lock_guard<std::mutex> lock{cache.mutex_};
+      cache.sessions_[*key] = std::move(copy);
+      cache.dirty_ = !cache.path_.empty();
+    }
+    cache.cv_.notify_one();
+
+    return 0;
+  }
+
+  static bool Resumable(const SSL_SESSION *session) {
+    return SSL_SESSION_is_resumable(session) &&
+           SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) >
+               std::time(nullptr);
+  }
+
+  // The file holds one key per line, each followed by its session in PEM
+  // form. It contains key material, so it is only readable by the owner.
+  void Load() {
+    BIO *bio = BIO_new_file(path_.c_str(), "r");
+    if (bio == nullptr) {
+      ERR_clear_error();
+      return;
+    }
+
+    char line[4096];
+    while (BIO_gets(bio, line, sizeof(line)) > 0) {
+      std::string key{line};
+      while (!key.empty() && (key.back() == '\n' || key.back() == '\r'))
+        key.pop_back();
+
+      Session session{PEM_read_bio_SSL_SESSION(bio, nullptr, nullptr, nullptr)};
+      if (!session)
+        break;
+
+      if (!key.empty() && Resumable(session.get()) && !sessions_.contains(key))
+        sessions_[key] = std::move(session);
+    }
+
+    BIO_free(bio);
+    ERR_clear_error();
+  }
+
+  // Tickets that arrive while the file is being written go out together in
+  // the next write.
+  void Write(std::stop_token stop) {
+    std::unique_lock<std::mutex> lock{mutex_};
+
+    while (cv_.wait(lock, stop, [this] { return dirty_; })) {
+      lock.unlock();
+      Save();
+      lock.lock();
+    }
+  }
+
+  void Save() {
+    std::lock_guard<std::mutex> file{file_mutex_};
+
+    std::string path;
+    std::vector<std::pair<std::string, Session>> sessions;
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+
+      if (!std::exchange(dirty_, false))
+        return;
+
+      path = path_;
+      sessions.reserve(sessions_.size());
+      for (const auto &[key, session] : sessions_) {
+        SSL_SESSION_up_ref(session.get());
+        sessions.emplace_back(key, Session{session.get()});
+      }
+    }
+
+    const std::string tmp = path + ".tmp";
+
+    BIO *bio = BIO_new_file(tmp.c_str(), "w");
+    if (bio == nullptr) {
+      ERR_clear_error();
+      return;
+    }
+
+    std::error_code ec;
+    std::filesystem::permissions(tmp,
+                                 std::filesystem::perms::owner_read |
+                                     std::filesystem::perms::owner_write,
+                                 ec);
+
+    bool ok = !ec;
+    for (const auto &[key, session] : sessions) {
+      ok = ok && BIO_printf(bio, "%s\n", key.c_str()) > 0 &&
+           PEM_write_bio_SSL_SESSION(bio, session.get()) == 1;
+    }
+    BIO_free(bio);
+
+    if (ok)
+      std::filesystem::rename(tmp, path, ec);
+    else
+      std::filesystem::remove(tmp, ec);
+
+    ERR_clear_error();
+  }
+
+  const int index_;
+  std::mutex mutex_, file_mutex_;
+  std::condition_variable_any cv_;
+  std::unordered_map<std::string, Session> sessions_;
+  std::string path_;
+  bool dirty_ = false;
+  std::jthread writer_;
+};
+
+// Building an SSL context parses the whole CA store, so every client with the
+// same trust configuration shares one context, released with its last client.
+class TlsContexts {
 public:
-  explicit xAIClient(const char *apikey, const char *host = default_host)
-      : io_context_{}, ssl_context_{boost::asio::ssl::context::tlsv12_client},
-        stream_{io_context_, ssl_context_}, host_{host} {
+  static TlsContexts &Instance() {
+    static TlsContexts &contexts = *new TlsContexts;
+    return contexts;
+  }
+
+  std::shared_ptr<boost::asio::ssl::context>
+  Acquire(const std::string &ca_file) {
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    std::weak_ptr<boost::asio::ssl::context> &entry = contexts_[ca_file];
+    if (std::shared_ptr<boost::asio::ssl::context> context = entry.lock())
+      return context;
+
+    std::shared_ptr<boost::asio::ssl::context> context = Make(ca_file);
+    entry = context;
+
+    return context;
+  }
+
+private:
+  static std::shared_ptr<boost::asio::ssl::context>
+  Make(const std::string &ca_file) {
+    auto context = std::make_shared<boost::asio::ssl::context>(
+        boost::asio::ssl::context::tls_client);
+
 #ifdef XAI_CERT_DEV
-    dev::load_certs(ssl_context_);
+    dev::load_certs(*context);
 #else
-    ssl_context_.set_verify_mode(boost::asio::ssl::verify_peer);
-    ssl_context_.set_default_verify_paths();
+    context->set_verify_mode(boost::asio::ssl::verify_peer);
+    if (ca_file.empty())
+      context->set_default_verify_paths();
 #endif
+    if (!ca_file.empty())
+      context->load_verify_file(ca_file);
 
-    if (!SSL_set_tlsext_host_name(stream_.native_handle(), host_.c_str())) {
+    SSL_CTX_set_min_proto_version(context->native_handle(), TLS1_2_VERSION);
+    // Unlike most of OpenSSL, this one returns 0 on success.
+    if (SSL_CTX_set_alpn_protos(context->native_handle(), Server::alpn,
+                                sizeof(Server::alpn) - 1) != 0) {
       boost::beast::error_code ec{static_cast<int>(::ERR_get_error()),
                                   boost::asio::error::get_ssl_category()};
       throw boost::beast::system_error{ec};
     }
 
-    boost::asio::ip::tcp::resolver resolver(io_context_);
-    const boost::asio::ip::tcp::resolver::results_type results =
-        resolver.resolve(host_, Server::port);
+    SessionCache::Instance().Attach(context->native_handle());
 
-    boost::beast::get_lowest_layer(stream_).connect(results);
+    return context;
+  }
 
-    stream_.handshake(boost::asio::ssl::stream_base::client);
+  std::mutex mutex_;
+  std::unordered_map<std::string, std::weak_ptr<boost::asio::ssl::context>>
+      contexts_;
+};
 
-    authorization_.reserve(135);
-    authorization_.assign("Bearer ", 7);
-    authorization_.append(apikey);
+class Resolver {
+public:
+  static Resolver &Instance() {
+    static Resolver &resolver = *new Resolver;
+    return resolver;
   }
 
-  ~xAIClient() final = default;
+  std::vector<boost::asio::ip::tcp::endpoint>
+  Resolve(const boost::asio::any_io_executor &executor, const std::string &host,
+          const std::string &port, std::chrono::seconds ttl) {
+    const std::string key = host + ':' + port;
 
-  std::unique_ptr<xai::Choices>
-  ChatCompletion(const std::unique_ptr<xai::Messages> &messages) final {
-    boost::json::object obj{
-        {"model", static_cast<xAIMessages *>(messages.get())->model_},
-        {"stream", false},
-        {"temperature", 0},
-        {"messages",
-         static_cast<const xAIMessages *>(messages.get())->messages_},
-    };
+    if (auto endpoints = Cached(key))
+      return std::move(*endpoints);
 
-    boost::beast::http::request<boost::beast::http::string_body> request{
-        boost::beast::http::verb::post, "/v1/chat/completions",
-        Server::version};
-    SetUp(request);
-    request.body() = boost::json::serialize(obj);
-    request.prepare_payload();
+    boost::asio::ip::tcp::resolver resolver(executor);
+    return Store(key, resolver.resolve(host, port), ttl);
+  }
 
-    boost::beast::http::response<boost::beast::http::dynamic_body> response =
-        Do(request);
+  boost::asio::awaitable<std::vector<boost::asio::ip::tcp::endpoint>>
+  AsyncResolve(boost::asio::any_io_executor executor, std::string host,
+               std::string port, std::chrono::seconds ttl) {
+    const std::string key = host + ':' + port;
 
-    boost::json::value value = boost::json::parse(
-        boost::beast::buffers_to_string(response.body().data()));
+    if (auto endpoints = Cached(key))
+      co_return std::move(*endpoints);
 
-    return std::make_unique<xAIContentChoices>(std::move(value.as_object()));
+    boost::asio::ip::tcp::resolver resolver(executor);
+    co_return Store(key,
+                    co_await resolver.async_resolve(host, port,
+                                                    boost::asio::use_awaitable),
+                    ttl);
   }
 
-  void ChatCompletion(
-      const std::unique_ptr<xai::Messages> &messages,
-      const std::function<void(std::unique_ptr<xai::Choices>)> &call) final {
-    boost::json::object obj{
-        {"model", static_cast<xAIMessages *>(messages.get())->model_},
-        {"stream", true},
-        {"temperature", 0},
-        {"messages",
-         static_cast<const xAIMessages *>(messages.get())->messages_},
-    };
+  void Forget(const std::string &host, const std::string &port) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    entries_.erase(host + ':' + port);
+  }
 
-    boost::beast::http::request<boost::beast::http::string_body> request{
-        boost::beast::http::verb::post, "/v1/chat/completions",
-        Server::version};
-    SetUp(request);
-    request.set(boost::beast::http::field::accept, "text/event-stream");
-    request.set(boost::beast::http::field::connection, "keep-alive");
-    request.body() = boost::json::serialize(obj);
-    request.prepare_payload();
+private:
+  struct Entry {
+    std::vector<boost::asio::ip::tcp::endpoint> endpoints;
+    std::chrono::steady_clock::time_point expiry;
+  };
 
-    boost::beast::http::write(stream_, request);
+  std::optional<std::vector<boost::asio::ip::tcp::endpoint>>
+  Cached(const std::string &key) {
+    std::lock_guard<std::mutex> lock{mutex_};
 
-    for (;;) {
-      boost::beast::flat_buffer buffer;
+    auto it = entries_.find(key);
+    if (it == entries_.end() ||
+        std::chrono::steady_clock::now() >= it->second.expiry)
+      return std::nullopt;
 
-      try {
-        std::size_t rsize = stream_.read_some(buffer.prepare(1024));
+    return it->second.endpoints;
+  }
 
-        if (rsize <= 5)
-          continue;
+  std::vector<boost::asio::ip::tcp::endpoint>
+  Store(const std::string &key,
+        const boost::asio::ip::tcp::resolver::results_type &results,
+        std::chrono::seconds ttl) {
+    std::vector<boost::asio::ip::tcp::endpoint> endpoints =
+        Interleave(results);
 
-        buffer.commit(rsize);
+    std::lock_guard<std::mutex> lock{mutex_};
+    entries_[key] = Entry{endpoints, std::chrono::steady_clock::now() + ttl};
 
-        std::string data = boost::beast::buffers_to_string(buffer.data());
+    return endpoints;
+  }
 
-        if (data.starts_with("HTTP/"))
-          continue;
+  // RFC 8305 section 4: alternate address families, starting with the family
+  // of the first address the system resolver returned.
+  static std::vector<boost::asio::ip::tcp::endpoint>
+  Interleave(const boost::asio::ip::tcp::resolver::results_type &results) {
+    std::vector<boost::asio::ip::tcp::endpoint> first, second;
+
+    for (const auto &result : results) {
+      const boost::asio::ip::tcp::endpoint endpoint = result.endpoint();
+      if (first.empty() || first.front().protocol() == endpoint.protocol())
+        first.push_back(endpoint);
+      else
+        second.push_back(endpoint);
+    }
+
+    std::vector<boost::asio::ip::tcp::endpoint> endpoints;
+    endpoints.reserve(first.size() + second.size());
+    for (std::size_t i = 0; i < std::max(first.size(), second.size()); ++i) {
+      if (i < first.size())
+        endpoints.push_back(first[i]);
+      if (i < second.size())
+        endpoints.push_back(second[i]);
+    }
 
-        buffer.consume(rsize);
+    return endpoints;
+  }
 
-        if (data.empty())
-          break;
+  std::mutex mutex_;
+  std::unordered_map<std::string, Entry> entries_;
+};
+
+// RFC 8305 connection racing: a new attempt starts every attempt_delay, or as
+// soon as the previous one fails, and the first socket to connect wins. The
+// race runs on a private io_context and the winning descriptor is handed over
+// to the caller's socket.
+class HappyEyeballs {
+public:
+  static constexpr std::chrono::milliseconds attempt_delay{250};
+
+  // Races on the caller's thread: non-blocking connects start one
+  // attempt_delay apart, or as soon as the previous one fails, and poll()
+  // waits for the first to succeed.
+  static void
+  Connect(boost::asio::ip::tcp::socket &socket,
+          const std::vector<boost::asio::ip::tcp::endpoint> &endpoints) {
+    std::vector<boost::asio::ip::tcp::socket> attempts;
+    std::vector<::pollfd> fds;
+    boost::beast::error_code error = boost::asio::error::host_not_found;
+    auto next = endpoints.begin();
+    std::chrono::steady_clock::time_point due;
+
+    for (;;) {
+      const auto now = std::chrono::steady_clock::now();
+
+      if (next != endpoints.end() && (attempts.empty() || now >= due)) {
+        boost::asio::ip::tcp::socket attempt{socket.get_executor()};
+        const boost::beast::error_code ec = Start(attempt, *next++);
+        due = now + attempt_delay;
+
+        if (!ec) {
+          socket = std::move(attempt);
+          return;
+        }
+
+        if (ec == boost::asio::error::in_progress) {
+          fds.push_back({attempt.native_handle(), POLLOUT, 0});
+          attempts.push_back(std::move(attempt));
+        } else {
+          error = ec;
+          due = now;
+        }
+        continue;
+      }
+
+      if (attempts.empty())
+        throw boost::beast::system_error{error};
+
+      int timeout = -1;
+      if (next != endpoints.end())
+        timeout = static_cast<int>(
+            std::chrono::ceil<std::chrono::milliseconds>(due - now).count());
 
-        if (data == "0\r\n\r\n")
+      if (::poll(fds.data(), fds.size(), timeout) < 0) {
+        if (errno == EINTR)
           continue;
+        throw boost::beast::system_error{
+            {errno, boost::asio::error::get_system_category()}};
+      }
 
-        if (data.ends_with("data: [DONE]\n\n\r\n"))
-          break;
+      for (std::size_t i = 0; i < fds.size();) {
+        if (fds[i].revents == 0) {
+          ++i;
+          continue;
+        }
 
-        std::size_t pos = 0;
-        while ((pos = data.find("data: ", pos)) != std::string::npos) {
-          pos += 6;
+        int value = 0;
+        ::socklen_t length = sizeof(value);
+        if (::getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &value, &length) !=
+            0)
+          value = errno;
+
+        if (value == 0) {
+          boost::beast::error_code ignored;
+          attempts[i].native_non_blocking(false, ignored);
+          socket = std::move(attempts[i]);
+          return;
+        }
 
-          std::size_t end = data.find("\n", pos);
+        error = {value, boost::asio::error::get_system_category()};
+        attempts.erase(attempts.begin() + static_cast<std::ptrdiff_t>(i));
+        fds.erase(fds.begin() + static_cast<std::ptrdiff_t>(i));
+        due = now;
+      }
+    }
+  }
 
-          if (end == std::string::npos)
-            break;
+  using Signature = void(boost::beast::error_code,
+                         boost::asio::ip::tcp::socket);
+
+  // The same race with asynchronous operations on the executor, completing
+  // with the winning socket.
+  template <typename CompletionToken>
+  static auto
+  AsyncConnect(const boost::asio::any_io_executor &executor,
+               std::vector<boost::asio::ip::tcp::endpoint> endpoints,
+               CompletionToken &&token) {
+    return boost::asio::async_initiate<CompletionToken, Signature>(
+        [executor](boost::asio::any_completion_handler<Signature> handler,
+                   std::vector<boost::asio::ip::tcp::endpoint> e) {
+          auto race =
+              std::make_shared<Race>(executor, std::move(e), std::move(handler));
+          boost::asio::dispatch(race->strand_, [race] { race->Next(); });
+        },
+        token, std::move(endpoints));
+  }
 
-          std::string payload = data.substr(pos, end - pos);
+private:
+  class Race : public std::enable_shared_from_this<Race> {
+  public:
+    Race(const boost::asio::any_io_executor &executor,
+         std::vector<boost::asio::ip::tcp::endpoint> endpoints,
+         boost::asio::any_completion_handler<Signature> handler)
+        : strand_{boost::asio::make_strand(executor)},
+          endpoints_{std::move(endpoints)}, timer_{strand_},
+          handler_{std::move(handler)} {}
+
+    // Starts the next attempt, or fails once every attempt has.
+    void Next() {
+      if (done_)
+        return;
+
+      if (next_ == endpoints_.size()) {
+        if (failed_ == next_)
+          Finish(error_, nullptr);
+        return;
+      }
 
-          boost::json::value value = boost::json::parse(payload);
+      boost::asio::ip::tcp::socket *attempt =
+          attempts_
+              .emplace_back(
+                  std::make_unique<boost::asio::ip::tcp::socket>(strand_))
+              .get();
+
+      attempt->async_connect(
+          endpoints_[next_++],
+          [self = this->shared_from_this(),
+           attempt](boost::beast::error_code ec) {
+            if (self->done_)
+              return;
+
+            if (ec) {
+              self->error_ = ec;
+              ++self->failed_;
+              self->Next();
+              return;
+            }
+
+            self->Finish(ec, attempt);
+          });
+
+      timer_.expires_after(attempt_delay);
+      timer_.async_wait([self = this->shared_from_this()](
+                            boost::beast::error_code ec) {
+        if (!ec)
+          self->Next();
+      });
+    }
 
-          call(std::make_unique<xAIDeltaChoices>(std::move(value.as_object())));
+    const boost::asio::strand<boost::asio::any_io_executor> strand_;
+
+  private:
+    void Finish(boost::beast::error_code ec,
+                boost::asio::ip::tcp::socket *winner) {
+      done_ = true;
+      timer_.cancel();
+
+      boost::asio::ip::tcp::socket socket{strand_};
+      for (auto &attempt : attempts_) {
+        if (attempt.get() == winner) {
+          socket = std::move(*attempt);
+        } else {
+          boost::beast::error_code ignored;
+          attempt->close(ignored);
         }
-      } catch (const boost::beast::system_error &e) {
-        if (e.code() == boost::asio::error::eof) {
-          break;
-        } else
-          throw;
       }
+
+      boost::asio::post(boost::asio::append(std::move(handler_), ec,
+                                            std::move(socket)));
     }
+
+    const std::vector<boost::asio::ip::tcp::endpoint> endpoints_;
+    boost::asio::steady_timer timer_;
+    boost::asio::any_completion_handler<Signature> handler_;
+    std::vector<std::unique_ptr<boost::asio::ip::tcp::socket>> attempts_;
+    std::size_t next_ = 0, failed_ = 0;
+    boost::beast::error_code error_ = boost::asio::error::host_not_found;
+    bool done_ = false;
+  };
+
+  // Starts a non-blocking connect, which reports in_progress until the
+  // socket becomes writable.
+  static boost::beast::error_code
+  Start(boost::asio::ip::tcp::socket &attempt,
+        const boost::asio::ip::tcp::endpoint &endpoint) {
+    boost::beast::error_code ec;
+    attempt.open(endpoint.protocol(), ec);
+    if (!ec)
+      attempt.native_non_blocking(true, ec);
+    if (ec)
+      return ec;
+
+    if (::connect(attempt.native_handle(), endpoint.data(),
+                  static_cast<::socklen_t>(endpoint.size())) == 0) {
+      attempt.native_non_blocking(false, ec);
+      return ec;
+    }
+
+    if (errno == EINPROGRESS)
+      return boost::asio::error::in_progress;
+    return {errno, boost::asio::error::get_system_category()};
   }
+};
 
-  std::unique_ptr<xai::ModelList> ListModels() final {
-    boost::beast::http::request<boost::beast::http::string_body> request{
-        boost::beast::http::verb::get, "/v1/models", Server::version};
-    SetUp(request);
+class TimerWheel;
+
+// Tracks the total, time-to-first-byte and inter-chunk limits of one request
+// attempt. Reads only call Touch(), a relaxed atomic store; the wheel notices
+// the new activity when the entry's slot comes around and files it again.
+// An expired request has its socket shut down, which wakes up any blocking or
+// asynchronous read on it, and Check() then reports the timeout.
+class Deadline {
+public:
+  using clock = std::chrono::steady_clock;
+
+  Deadline(const xai::Client::Options &options, clock::time_point start,
+           int socket);
 
-    boost::beast::http::response<boost::beast::http::dynamic_body> response =
-        Do(request);
+  // For a request that shares its connection: expiry calls `expire`, from
+  // the wheel's thread, instead of shutting a socket down.
+  Deadline(const xai::Client::Options &options, clock::time_point start,
+           std::function<void()> expire);
 
-    boost::json::value value = boost::json::parse(
-        boost::beast::buffers_to_string(response.body().data()));
+  Deadline(const Deadline &) = delete;
+  Deadline &operator=(const Deadline &) = delete;
 
-    return std::make_unique<xAIModelList>(std::move(value.as_object()));
+  ~Deadline();
+
+  void Touch() noexcept {
+    last_read_.store(clock::now().time_since_epoch().count(),
+                     std::memory_order_relaxed);
+    paused_.store(false, std::memory_order_release);
   }
 
-  std::unique_ptr<xai::LanguageModelList> ListLanguageModels() final {
-    boost::beast::http::request<boost::beast::http::string_body> request{
-        boost::beast::http::verb::get, "/v1/language-models", Server::version};
-    SetUp(request);
+  // Stops the time between reads from running until the next Touch, while
+  // the consumer of a pulled stream is busy elsewhere.
+  void Pause() noexcept { paused_.store(true, std::memory_order_release); }
+
+  void Check() const {
+    if (expired_.load(std::memory_order_acquire))
+      throw boost::beast::system_error{boost::beast::error::timeout};
+  }
+
+private:
+  friend class TimerWheel;
+
+  clock::time_point Due() const {
+    clock::time_point due = clock::time_point::max();
+
+    if (total_.count() > 0)
+      due = start_ + total_;
+
+    const clock::rep last_read = last_read_.load(std::memory_order_relaxed);
+    if (last_read == 0 || paused_.load(std::memory_order_acquire)) {
+      if (last_read == 0 && first_byte_.count() > 0)
+        due = std::min(due, armed_ + first_byte_);
+      // Looked at again later, in case reading starts or resumes.
+      if (between_reads_.count() > 0)
+        due = std::min(due, clock::now() + between_reads_);
+    } else if (between_reads_.count() > 0) {
+      due = std::min(due, clock::time_point{clock::duration{last_read}} +
+                              between_reads_);
+    }
+
+    return due;
+  }
+
+  bool Enabled() const {
+    return total_.count() > 0 || first_byte_.count() > 0 ||
+           between_reads_.count() > 0;
+  }
+
+  const clock::time_point start_, armed_;
+  const clock::duration total_, first_byte_, between_reads_;
+  const int socket_;
+  const std::function<void()> expire_;
+  std::atomic<clock::rep> last_read_{0};
+  std::atomic<bool> expired_{false}, paused_{false};
+  Deadline *prev_ = nullptr, *next_ = nullptr;
+  std::size_t slot_ = 0;
+  bool linked_ = false;
+};
+
+// Hashed timer wheel shared by every client: filing, moving and removing an
+// entry are constant-time list operations, so tens of thousands of requests
+// in flight cost one thread that wakes up once per tick.
+class TimerWheel {
+public:
+  static constexpr std::chrono::milliseconds tick{10};
+  static constexpr std::size_t slots = 1024;
+
+  static TimerWheel &Instance() {
+    static TimerWheel &wheel = *new TimerWheel;
+    return wheel;
+  }
+
+  void Add(Deadline &deadline) {
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+
+      if (!thread_.joinable()) {
+        cursor_ = Tick(Deadline::clock::now());
+        thread_ = std::jthread{[this](std::stop_token stop) { Run(stop); }};
+      }
 
-    boost::beast::http::response<boost::beast::http::dynamic_body> response =
-        Do(request);
+      File(deadline);
+      ++size_;
+    }
+    cv_.notify_one();
+  }
 
-    boost::json::value value = boost::json::parse(
-        boost::beast::buffers_to_string(response.body().data()));
+  void Remove(Deadline &deadline) {
+    std::lock_guard<std::mutex> lock{mutex_};
 
-    return std::make_unique<xAILanguageModelList>(std::move(value.as_object()));
+    if (deadline.linked_) {
+      Unlink(deadline);
+      --size_;
+    }
   }
 
 private:
-  boost::asio::io_context io_context_;
-  boost::asio::ssl::context ssl_context_;
-  boost::asio::ssl::stream<boost::beast::tcp_stream> stream_;
-  std::string host_;
-  std::string authorization_;
+  static std::int64_t Tick(Deadline::clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               time.time_since_epoch())
+               .count() /
+           tick.count();
+  }
 
-  inline void
-  SetUp(boost::beast::http::request<boost::beast::http::string_body> &request) {
-    request.set(boost::beast::http::field::host, host_);
-    request.set(boost::beast::http::field::content_type, Server::content_type);
-    request.set(boost::beast::http::field::authorization, authorization_);
-    request.set(boost::beast::http::field::user_agent, Server::user_agent);
+  void File(Deadline &deadline) {
+    const Deadline::clock::time_point due = deadline.Due();
+    const std::int64_t at =
+        due == Deadline::clock::time_point::max()
+            ? cursor_ + static_cast<std::int64_t>(slots)
+            : std::max(Tick(due) + 1, cursor_ + 1);
+
+    Deadline *&head = heads_[static_cast<std::size_t>(at) % slots];
+    deadline.prev_ = nullptr;
+    deadline.next_ = head;
+    if (head != nullptr)
+      head->prev_ = &deadline;
+    head = &deadline;
+    deadline.slot_ = static_cast<std::size_t>(at) % slots;
+    deadline.linked_ = true;
   }
 
-  inline boost::beast::http::response<boost::beast::http::dynamic_body>
-  Do(boost::beast::http::request<boost::beast::http::string_body> &request) {
-    boost::beast::http::write(stream_, request);
+  void Unlink(Deadline &deadline) {
+    if (deadline.prev_ != nullptr)
+      deadline.prev_->next_ = deadline.next_;
+    else
+      heads_[deadline.slot_] = deadline.next_;
+    if (deadline.next_ != nullptr)
+      deadline.next_->prev_ = deadline.prev_;
+    deadline.prev_ = deadline.next_ = nullptr;
+    deadline.linked_ = false;
+  }
+
+  void Run(std::stop_token stop) {
+    std::unique_lock<std::mutex> lock{mutex_};
+
+    while (!stop.stop_requested()) {
+      if (size_ == 0) {
+        cv_.wait(lock, stop, [this] { return size_ > 0; });
+        cursor_ = Tick(Deadline::clock::now());
+        continue;
+      }
 
-    boost::beast::flat_buffer buffer;
+      cv_.wait_until(lock, stop,
+                     Deadline::clock::time_point{(cursor_ + 1) * tick},
+                     [] { return false; });
 
-    boost::beast::http::response<boost::beast::http::dynamic_body> response;
+      const Deadline::clock::time_point now = Deadline::clock::now();
+      const std::int64_t current = Tick(now);
 
-    boost::beast::http::read(stream_, buffer, response);
+      while (cursor_ < current) {
+        ++cursor_;
 
-    return response;
+        const std::size_t slot = static_cast<std::size_t>(cursor_) % slots;
+        Deadline *deadline = heads_[slot];
+        heads_[slot] = nullptr;
+
+        while (deadline != nullptr) {
+          Deadline *next = deadline->next_;
+          deadline->linked_ = false;
+
+          if (deadline->Due() <= now) {
+            deadline->expired_.store(true, std::memory_order_release);
+            if (deadline->expire_)
+              deadline->expire_();
+            else
+              ::shutdown(deadline->socket_, SHUT_RDWR);
+            --size_;
+          } else {
+            File(*deadline);
+          }
+
+          deadline = next;
+        }
+      }
+    }
   }
-};
 
-} // namespace
+  std::mutex mutex_;
+  std::condition_variable_any cv_;
+  std::array<Deadline *, slots> heads_{};
+  std::int64_t cursor_ = 0;
+  std::size_t size_ = 0;
+  std::jthread thread_;
+};
 
-namespace xai {
+Deadline::Deadline(const xai::Client::Options &options,
+                   clock::time_point start, int socket)
+    : start_{start}, armed_{clock::now()}, total_{options.request_timeout},
+      first_byte_{options.first_byte_timeout},
+      between_reads_{options.read_timeout}, socket_{socket} {
+  if (Enabled())
+    TimerWheel::Instance().Add(*this);
+}
 
-Choices::~Choices() = default;
-Messages::~Messages() = default;
-ModelList::~ModelList() = default;
-LanguageModelList::~LanguageModelList() = default;
-Client::~Client() = default;
+Deadline::Deadline(const xai::Client::Options &options,
+                   clock::time_point start, std::function<void()> expire)
+    : start_{start}, armed_{clock::now()}, total_{options.request_timeout},
+      first_byte_{options.first_byte_timeout},
+      between_reads_{options.read_timeout}, socket_{-1},
+      expire_{std::move(expire)} {
+  if (Enabled())
+    TimerWheel::Instance().Add(*this);
+}
 
-std::unique_ptr<Client> Client::Make(const char *apikey) {
-  return std::make_unique<xAIClient>(apikey);
+Deadline::~Deadline() {
+  if (Enabled())
+    TimerWheel::Instance().Remove(*this);
 }
 
-std::unique_ptr<Client> Client::Make(const char *apikey, const char *host) {
-  return std::make_unique<xAIClient>(apikey, host);
+// TLS stream on which OpenSSL owns the socket instead of working on memory
+// buffers, which lets it hand the record layer to the kernel (kTLS) after the
+// handshake. Reads and writes still go through SSL_read_ex and SSL_write_ex,
+// so control records such as session tickets are handled, but with kTLS they
+// come down to a recvmsg or sendmsg on the socket without userspace crypto.
+// The socket stays non-blocking and waits for readiness when OpenSSL asks.
+class KtlsStream {
+public:
+  using executor_type = boost::asio::any_io_executor;
+
+  KtlsStream(const boost::asio::any_io_executor &executor,
+             boost::asio::ssl::context &ssl_context)
+      : socket_{executor}, ssl_{::SSL_new(ssl_context.native_handle())} {
+    if (!ssl_)
+      throw boost::beast::system_error{Error(SSL_ERROR_SSL)};
+#ifdef SSL_OP_ENABLE_KTLS
+    ::SSL_set_options(ssl_.get(), SSL_OP_ENABLE_KTLS);
+#endif
+  }
+
+  executor_type get_executor() { return socket_.get_executor(); }
+
+  boost::asio::ip::tcp::socket &next_layer() { return socket_; }
+
+  SSL *native_handle() { return ssl_.get(); }
+
+  void handshake() {
+    Attach();
+
+    boost::beast::error_code ec;
+    Run(
+        [this](std::size_t &) { return ::SSL_connect(ssl_.get()); }, ec,
+        false);
+    if (ec)
+      throw boost::beast::system_error{ec};
+  }
+
+  // Completes like a read, with a size of zero.
+  template <typename HandshakeToken>
+  auto async_handshake(HandshakeToken &&token) {
+    Attach();
+
+    return boost::asio::async_compose<HandshakeToken,
+                                      void(boost::beast::error_code,
+                                           std::size_t)>(
+        Op{*this, [this](std::size_t &) { return ::SSL_connect(ssl_.get()); }},
+        token, socket_);
+  }
+
+  // Whether the kernel took over both directions of the record layer.
+  bool offloaded() const {
+#ifndef OPENSSL_NO_KTLS
+    return BIO_get_ktls_send(::SSL_get_wbio(ssl_.get())) &&
+           BIO_get_ktls_recv(::SSL_get_rbio(ssl_.get()));
+#else
+    return false;
+#endif
+  }
+
+  // The socket itself is always non-blocking; this only decides whether the
+  // synchronous operations wait or report would_block.
+  void non_blocking(bool mode, boost::beast::error_code &ec) {
+    non_blocking_ = mode;
+    ec = {};
+  }
+
+  template <typename MutableBufferSequence>
+  std::size_t read_some(const MutableBufferSequence &buffers,
+                        boost::beast::error_code &ec) {
+    return Run(Reader(buffers), ec, non_blocking_);
+  }
+
+  template <typename MutableBufferSequence>
+  std::size_t read_some(const MutableBufferSequence &buffers) {
+    boost::beast::error_code ec;
+    std::size_t size = read_some(buffers, ec);
+    if (ec)
+      throw boost::beast::system_error{ec};
+    return size;
+  }
+
+  template <typename ConstBufferSequence>
+  std::size_t write_some(const ConstBufferSequence &buffers,
+                         boost::beast::error_code &ec) {
+    return Run(Writer(buffers), ec, non_blocking_);
+  }
+
+  template <typename ConstBufferSequence>
+  std::size_t write_some(const ConstBufferSequence &buffers) {
+    boost::beast::error_code ec;
+    std::size_t size = write_some(buffers, ec);
+    if (ec)
+      throw boost::beast::system_error{ec};
+    return size;
+  }
+
+  template <typename MutableBufferSequence, typename ReadToken>
+  auto async_read_some(const MutableBufferSequence &buffers,
+                       ReadToken &&token) {
+    return boost::asio::async_compose<ReadToken,
+                                      void(boost::beast::error_code,
+                                           std::size_t)>(
+        Op{*this, Reader(buffers)}, token, socket_);
+  }
+
+  template <typename ConstBufferSequence, typename WriteToken>
+  auto async_write_some(const ConstBufferSequence &buffers,
+                        WriteToken &&token) {
+    return boost::asio::async_compose<WriteToken,
+                                      void(boost::beast::error_code,
+                                           std::size_t)>(
+        Op{*this, Writer(buffers)}, token, socket_);
+  }
+
+private:
+  void Attach() {
+    socket_.native_non_blocking(true);
+    if (!::SSL_set_fd(ssl_.get(), socket_.native_handle()))
+      throw boost::beast::system_error{Error(SSL_ERROR_SSL)};
+  }
+
+  // SSL_read_ex and SSL_write_ex take one buffer, so only the first
+  // non-empty buffer of a sequence is used, as read_some allows.
+  template <typename Buffer, typename BufferSequence>
+  static Buffer First(const BufferSequence &buffers) {
+    for (auto it = boost::asio::buffer_sequence_begin(buffers);
+         it != boost::asio::buffer_sequence_end(buffers); ++it) {
+      Buffer buffer = *it;
+      if (buffer.size() > 0)
+        return buffer;
+    }
+    return {};
+  }
+
+  template <typename MutableBufferSequence>
+  auto Reader(const MutableBufferSequence &buffers) {
+    return [this, buffer = First<boost::asio::mutable_buffer>(buffers)](
+               std::size_t &size) {
+      return buffer.size() == 0 ? 1
+                                : ::SSL_read_ex(ssl_.get(), buffer.data(),
+                                                buffer.size(), &size);
+    };
+  }
+
+  template <typename ConstBufferSequence>
+  auto Writer(const ConstBufferSequence &buffers) {
+    return [this, buffer = First<boost::asio::const_buffer>(buffers)](
+               std::size_t &size) {
+      return buffer.size() == 0 ? 1
+                                : ::SSL_write_ex(ssl_.get(), buffer.data(),
+                                                 buffer.size(), &size);
+    };
+  }
+
+  template <typename Operation>
+  std::size_t Run(Operation operation, boost::beast::error_code &ec,
+                  bool non_blocking) {
+    for (;;) {
+      std::size_t size = 0;
+      // SSL_get_error and Error() read both, so stale values from an
+      // earlier call must not linger.
+      ::ERR_clear_error();
+      errno = 0;
+      const int result = operation(size);
+      if (result == 1) {
+        ec = {};
+        return size;
+      }
+
+      const int error = ::SSL_get_error(ssl_.get(), result);
+      if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) {
+        ec = Error(error);
+        return 0;
+      }
+
+      if (non_blocking) {
+        ec = boost::asio::error::would_block;
+        return 0;
+      }
+
+      socket_.wait(error == SSL_ERROR_WANT_READ
+                       ? boost::asio::ip::tcp::socket::wait_read
+                       : boost::asio::ip::tcp::socket::wait_write,
+                   ec);
+      if (ec)
+        return 0;
+    }
+  }
+
+  template <typename Operation> class Op {
+  public:
+    Op(KtlsStream &stream, Operation operation)
+        : stream_{stream}, operation_{std::move(operation)} {}
+
+    template <typename Self>
+    void operator()(Self &self, boost::beast::error_code ec = {}) {
+      if (posted_) {
+        self.complete(ec_, size_);
+        return;
+      }
+
+      if (!ec) {
+        ::ERR_clear_error();
+        errno = 0;
+        const int result = operation_(size_);
+        if (result != 1) {
+          const int error = ::SSL_get_error(stream_.ssl_.get(), result);
+          if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+            waited_ = true;
+            stream_.socket_.async_wait(
+                error == SSL_ERROR_WANT_READ
+                    ? boost::asio::ip::tcp::socket::wait_read
+                    : boost::asio::ip::tcp::socket::wait_write,
+                std::move(self));
+            return;
+          }
+          ec = Error(error);
+        }
+      }
+
+      if (waited_) {
+        self.complete(ec, size_);
+        return;
+      }
+
+      // Finished without waiting: complete from the executor rather than
+      // from inside the initiating function.
+      posted_ = true;
+      ec_ = ec;
+      boost::asio::post(stream_.get_executor(), std::move(self));
+    }
+
+  private:
+    KtlsStream &stream_;
+    Operation operation_;
+    boost::beast::error_code ec_;
+    std::size_t size_ = 0;
+    bool waited_ = false, posted_ = false;
+  };
+
+  template <typename Operation>
+  Op(KtlsStream &, Operation) -> Op<Operation>;
+
+  static boost::beast::error_code Error(int error) {
+    if (error == SSL_ERROR_ZERO_RETURN)
+      return boost::asio::error::eof;
+
+    if (error == SSL_ERROR_SYSCALL && errno != 0)
+      return {errno, boost::system::system_category()};
+
+    const unsigned long code = ::ERR_get_error();
+    if (code == 0)
+      return boost::asio::ssl::error::stream_truncated;
+
+    return {static_cast<int>(code), boost::asio::error::get_ssl_category()};
+  }
+
+  struct Free {
+    void operator()(SSL *ssl) const { ::SSL_free(ssl); }
+  };
+
+  boost::asio::ip::tcp::socket socket_;
+  std::unique_ptr<SSL, Free> ssl_;
+  bool non_blocking_ = false;
+};
+
+// The stream a connection runs over, chosen by Options::transport. It offers
+// what Beast expects from a stream, so the HTTP code does not depend on it,
+// and a plain TCP or Unix domain socket does not go through OpenSSL at all.
+class AnyStream {
+public:
+  using Tls = boost::asio::ssl::stream<boost::asio::ip::tcp::socket>;
+  using Ktls = KtlsStream;
+  using Tcp = boost::asio::ip::tcp::socket;
+  using Local = boost::asio::local::stream_protocol::socket;
+  using executor_type = boost::asio::any_io_executor;
+
+  AnyStream(const boost::asio::any_io_executor &executor,
+            boost::asio::ssl::context *ssl_context,
+            const xai::Client::Options &options)
+      : stream_{Make(executor, ssl_context, options)} {}
+
+  template <typename Stream> Stream *get_if() {
+    return std::get_if<Stream>(&stream_);
+  }
+
+  // The OpenSSL session of a TLS stream, or null.
+  SSL *ssl() {
+    if (Tls *tls = get_if<Tls>())
+      return tls->native_handle();
+    if (Ktls *ktls = get_if<Ktls>())
+      return ktls->native_handle();
+    return nullptr;
+  }
+
+  // The TCP socket under a TLS or plain TCP stream, or null.
+  boost::asio::ip::tcp::socket *tcp() {
+    if (Tls *tls = get_if<Tls>())
+      return &tls->next_layer();
+    if (Ktls *ktls = get_if<Ktls>())
+      return &ktls->next_layer();
+    return get_if<Tcp>();
+  }
+
+  void handshake() {
+    if (Tls *tls = get_if<Tls>())
+      tls->handshake(boost::asio::ssl::stream_base::client);
+    else if (Ktls *ktls = get_if<Ktls>())
+      ktls->handshake();
+  }
+
+  boost::asio::awaitable<void> AsyncHandshake() {
+    if (Tls *tls = get_if<Tls>())
+      co_await tls->async_handshake(boost::asio::ssl::stream_base::client,
+                                    boost::asio::use_awaitable);
+    else if (Ktls *ktls = get_if<Ktls>())
+      co_await ktls->async_handshake(boost::asio::use_awaitable);
+  }
+
+  executor_type get_executor() {
+    return std::visit(
+        [](auto &stream) -> executor_type { return stream.get_executor(); },
+        stream_);
+  }
+
+  int native_handle() {
+    return std::visit(
+        [](auto &stream) {
+          return boost::beast::get_lowest_layer(stream).native_handle();
+        },
+        stream_);
+  }
+
+  void non_blocking(bool mode, boost::beast::error_code &ec) {
+    std::visit(
+        [&](auto &stream) {
+          if constexpr (std::is_same_v<decltype(stream), Ktls &>)
+            stream.non_blocking(mode, ec);
+          else
+            boost::beast::get_lowest_layer(stream).non_blocking(mode, ec);
+        },
+        stream_);
+  }
+
+  template <typename MutableBufferSequence>
+  std::size_t read_some(const MutableBufferSequence &buffers) {
+    return std::visit([&](auto &stream) { return stream.read_some(buffers); },
+                      stream_);
+  }
+
+  template <typename MutableBufferSequence>
+  std::size_t read_some(const MutableBufferSequence &buffers,
+                        boost::beast::error_code &ec) {
+    return std::visit(
+        [&](auto &stream) { return stream.read_some(buffers, ec); }, stream_);
+  }
+
+  template <typename ConstBufferSequence>
+  std::size_t write_some(const ConstBufferSequence &buffers) {
+    return std::visit([&](auto &stream) { return stream.write_some(buffers); },
+                      stream_);
+  }
+
+  template <typename ConstBufferSequence>
+  std::size_t write_some(const ConstBufferSequence &buffers,
+                         boost::beast::error_code &ec) {
+    return std::visit(
+        [&](auto &stream) { return stream.write_some(buffers, ec); },
+        stream_);
+  }
+
+  template <typename MutableBufferSequence, typename ReadToken>
+  auto async_read_some(const MutableBufferSequence &buffers,
+                       ReadToken &&token) {
+    return boost::asio::async_initiate<ReadToken,
+                                       void(boost::beast::error_code,
+                                            std::size_t)>(
+        [this](auto handler, const MutableBufferSequence &b) {
+          std::visit(
+              [&](auto &stream) {
+                stream.async_read_some(b, std::move(handler));
+              },
+              stream_);
+        },
+        token, buffers);
+  }
+
+  template <typename ConstBufferSequence, typename WriteToken>
+  auto async_write_some(const ConstBufferSequence &buffers,
+                        WriteToken &&token) {
+    return boost::asio::async_initiate<WriteToken,
+                                       void(boost::beast::error_code,
+                                            std::size_t)>(
+        [this](auto handler, const ConstBufferSequence &b) {
+          std::visit(
+              [&](auto &stream) {
+                stream.async_write_some(b, std::move(handler));
+              },
+              stream_);
+        },
+        token, buffers);
+  }
+
+private:
+  using Variant = std::variant<Tls, Ktls, Tcp, Local>;
+
+  static Variant Make(const boost::asio::any_io_executor &executor,
+                      boost::asio::ssl::context *ssl_context,
+                      const xai::Client::Options &options) {
+    switch (options.transport) {
+    case xai::Client::Transport::tcp:
+      return Variant{std::in_place_type<Tcp>, executor};
+    case xai::Client::Transport::local:
+      return Variant{std::in_place_type<Local>, executor};
+    case xai::Client::Transport::tls:
+      break;
+    }
+    if (options.kernel_tls)
+      return Variant{std::in_place_type<Ktls>, executor, *ssl_context};
+    return Variant{std::in_place_type<Tls>, executor, *ssl_context};
+  }
+
+  Variant stream_;
+};
+
+class Connection {
+public:
+  // With `http2`, the handshake offers h2 ahead of http/1.1 and Protocol()
+  // tells which one the server picked.
+  Connection(const boost::asio::any_io_executor &executor,
+             boost::asio::ssl::context *ssl_context, const std::string &host,
+             const xai::Client::Options &options, bool http2 = false)
+      : Connection{executor, ssl_context, options} {
+    if (AnyStream::Local *local = stream_.get_if<AnyStream::Local>()) {
+      local->connect(
+          boost::asio::local::stream_protocol::endpoint{options.socket_path});
+      return;
+    }
+
+    Identify(host, options, http2);
+
+    boost::asio::ip::tcp::socket &socket = *stream_.tcp();
+
+    const auto [peer, port] = Peer(host, options);
+
+    Resolver &resolver = Resolver::Instance();
+    try {
+      HappyEyeballs::Connect(
+          socket, resolver.Resolve(executor, peer, port, options.dns_ttl));
+    } catch (const boost::beast::system_error &) {
+      resolver.Forget(peer, port);
+      throw;
+    }
+
+    if (!options.proxy.empty()) {
+      boost::beast::http::write(socket, TunnelRequest(host, options));
+
+      boost::beast::flat_buffer buffer;
+      boost::beast::http::response_parser<boost::beast::http::empty_body>
+          parser;
+      parser.skip(true);
+      boost::beast::http::read(socket, buffer, parser);
+      CheckTunnel(parser);
+    }
+
+    stream_.handshake();
+  }
+
+  // Opens a connection the same way with asynchronous operations on the
+  // executor, so no thread blocks on the resolve, connect or handshake.
+  static boost::asio::awaitable<std::unique_ptr<Connection>>
+  AsyncOpen(boost::asio::any_io_executor executor,
+            boost::asio::ssl::context *ssl_context, std::string host,
+            const xai::Client::Options &options) {
+    std::unique_ptr<Connection> connection{
+        new Connection{executor, ssl_context, options}};
+    AnyStream &stream = connection->stream_;
+
+    if (AnyStream::Local *local = stream.get_if<AnyStream::Local>()) {
+      co_await local->async_connect(
+          boost::asio::local::stream_protocol::endpoint{options.socket_path},
+          boost::asio::use_awaitable);
+      co_return connection;
+    }
+
+    connection->Identify(host, options, false);
+
+    boost::asio::ip::tcp::socket &socket = *stream.tcp();
+
+    const auto [peer, port] = Peer(host, options);
+
+    Resolver &resolver = Resolver::Instance();
+    try {
+      socket = co_await HappyEyeballs::AsyncConnect(
+          executor,
+          co_await resolver.AsyncResolve(executor, peer, port, options.dns_ttl),
+          boost::asio::use_awaitable);
+    } catch (const boost::beast::system_error &) {
+      resolver.Forget(peer, port);
+      throw;
+    }
+
+    if (!options.proxy.empty()) {
+      co_await boost::beast::http::async_write(
+          socket, TunnelRequest(host, options), boost::asio::use_awaitable);
+
+      boost::beast::flat_buffer buffer;
+      boost::beast::http::response_parser<boost::beast::http::empty_body>
+          parser;
+      parser.skip(true);
+      co_await boost::beast::http::async_read(socket, buffer, parser,
+                                              boost::asio::use_awaitable);
+      CheckTunnel(parser);
+    }
+
+    co_await stream.AsyncHandshake();
+
+    co_return connection;
+  }
+
+  // An idle connection has nothing to read: a non-blocking read that does not
+  // report would_block means the peer closed it or sent something unexpected.
+  bool Alive() {
+    boost::beast::error_code ec, ignored;
+
+    stream_.non_blocking(true, ec);
+    if (ec)
+      return false;
+
+    char byte;
+    stream_.read_some(boost::asio::buffer(&byte, 1), ec);
+    stream_.non_blocking(false, ignored);
+
+    return ec == boost::asio::error::would_block;
+  }
+
+  int native_handle() { return stream_.native_handle(); }
+
+  // The protocol the server selected with ALPN, empty when it did not take
+  // part or the connection is not TLS.
+  std::string_view Protocol() {
+    SSL *ssl = stream_.ssl();
+    if (!ssl)
+      return {};
+
+    const unsigned char *protocol = nullptr;
+    unsigned int size = 0;
+    SSL_get0_alpn_selected(ssl, &protocol, &size);
+    return {reinterpret_cast<const char *>(protocol), size};
+  }
+
+  AnyStream stream_;
+  std::chrono::steady_clock::time_point idle_since_;
+
+  // Reused by every request sent on the connection.
+  std::string body_, spare_, fields_;
+
+private:
+  // Splits "[http://]host[:port]", where the port defaults to 80 and an IPv6
+  // host is written in brackets.
+  static std::pair<std::string, std::string>
+  ProxyAddress(std::string_view proxy) {
+    if (proxy.starts_with("http://"))
+      proxy.remove_prefix(7);
+    if (proxy.ends_with('/'))
+      proxy.remove_suffix(1);
+
+    std::string_view port = "80";
+    const std::size_t colon = proxy.rfind(':');
+    if (colon != std::string_view::npos && !proxy.ends_with(']')) {
+      port = proxy.substr(colon + 1);
+      proxy = proxy.substr(0, colon);
+    }
+
+    if (proxy.starts_with('[') && proxy.ends_with(']'))
+      proxy = proxy.substr(1, proxy.size() - 2);
+
+    return {std::string{proxy}, std::string{port}};
+  }
+
+  Connection(const boost::asio::any_io_executor &executor,
+             boost::asio::ssl::context *ssl_context,
+             const xai::Client::Options &options)
+      : stream_{executor, ssl_context, options} {}
+
+  // Names the server for SNI, offers a session saved for it and, for
+  // HTTP/2, the protocols to pick from.
+  void Identify(const std::string &host, const xai::Client::Options &options,
+                bool http2) {
+    SSL *ssl = stream_.ssl();
+    if (!ssl)
+      return;
+
+    if (!SSL_set_tlsext_host_name(ssl, host.c_str()) ||
+        (http2 && SSL_set_alpn_protos(ssl, Server::alpn_h2,
+                                      sizeof(Server::alpn_h2) - 1) != 0)) {
+      boost::beast::error_code ec{static_cast<int>(::ERR_get_error()),
+                                  boost::asio::error::get_ssl_category()};
+      throw boost::beast::system_error{ec};
+    }
+
+    SessionCache::Instance().Resume(ssl, host, options);
+  }
+
+  // The address the socket connects to: the server, or the proxy in front of
+  // it.
+  static std::pair<std::string, std::string>
+  Peer(const std::string &host, const xai::Client::Options &options) {
+    return options.proxy.empty() ? std::pair{host, options.port}
+                                 : ProxyAddress(options.proxy);
+  }
+
+  // Asks the proxy for a tunnel to the server. The tunnel lasts as long as
+  // the connection, so pooled connections pay for it only once.
+  static boost::beast::http::request<boost::beast::http::empty_body>
+  TunnelRequest(const std::string &host, const xai::Client::Options &options) {
+    const std::string target = host + ':' + options.port;
+
+    boost::beast::http::request<boost::beast::http::empty_body> request{
+        boost::beast::http::verb::connect, target, Server::version};
+    request.set(boost::beast::http::field::host, target);
+    request.set(boost::beast::http::field::user_agent, Server::user_agent);
+    if (!options.proxy_authorization.empty())
+      request.set(boost::beast::http::field::proxy_authorization,
+                  options.proxy_authorization);
+
+    return request;
+  }
+
+  static void CheckTunnel(
+      const boost::beast::http::response_parser<boost::beast::http::empty_body>
+          &parser) {
+    if (boost::beast::http::to_status_class(parser.get().result()) !=
+        boost::beast::http::status_class::successful)
+      throw boost::beast::system_error{boost::beast::http::error::bad_status};
+  }
+};
+
+class Pool {
+public:
+  using Handler = boost::asio::any_completion_handler<void(
+      std::exception_ptr, std::unique_ptr<Connection>, bool)>;
+
+  class Lease {
+  public:
+    Lease(Pool &pool, std::unique_ptr<Connection> connection, bool reused)
+        : pool_{&pool}, connection_{std::move(connection)}, reused_{reused} {}
+
+    Lease(Lease &&other) noexcept
+        : pool_{other.pool_}, connection_{std::move(other.connection_)},
+          reused_{other.reused_} {}
+
+    Lease(const Lease &) = delete;
+    Lease &operator=(const Lease &) = delete;
+    Lease &operator=(Lease &&) = delete;
+
+    ~Lease() {
+      if (connection_) {
+        connection_.reset();
+        pool_->Drop();
+      }
+    }
+
+    Connection *operator->() const { return connection_.get(); }
+    Connection &operator*() const { return *connection_; }
+
+    bool reused() const { return reused_; }
+
+    void Recycle() { pool_->Return(std::move(connection_)); }
+
+  private:
+    Pool *pool_;
+    std::unique_ptr<Connection> connection_;
+    bool reused_;
+  };
+
+  Pool(std::size_t min, std::size_t max,
+       std::chrono::steady_clock::duration idle_timeout,
+       std::function<std::unique_ptr<Connection>()> make,
+       std::function<boost::asio::awaitable<std::unique_ptr<Connection>>()>
+           async_make)
+      : max_{std::max<std::size_t>(max, 1)}, min_{std::min(min, max_)},
+        idle_timeout_{idle_timeout}, make_{std::move(make)},
+        async_make_{std::move(async_make)} {}
+
+  void WarmUp(bool background) {
+    if (!background) {
+      std::vector<Lease> leases;
+      leases.reserve(min_);
+      while (leases.size() < min_) {
+        leases.emplace_back(Checkout());
+      }
+      for (auto &lease : leases) {
+        lease.Recycle();
+      }
+    }
+
+    maintainer_ =
+        std::jthread{[this](std::stop_token stop) { Maintain(stop); }};
+  }
+
+  void Prewarm() {
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      prewarm_ = true;
+    }
+    cv_.notify_all();
+  }
+
+  Lease Checkout() {
+    std::unique_lock<std::mutex> lock{mutex_};
+
+    for (;;) {
+      cv_.wait(lock, [this] {
+        return !idle_.empty() || (size_ < max_ && opening_ == 0);
+      });
+
+      if (idle_.empty())
+        break;
+
+      std::unique_ptr<Connection> connection = std::move(idle_.back());
+      idle_.pop_back();
+      lock.unlock();
+
+      if (!Expired(*connection) && connection->Alive())
+        return Lease{*this, std::move(connection), true};
+
+      connection.reset();
+      lock.lock();
+      --size_;
+    }
+
+    ++size_;
+    lock.unlock();
+
+    return Open();
+  }
+
+  // Completes with an idle connection right away, or queues the caller until
+  // a connection is returned or there is room to open one. Connections for
+  // queued callers are opened with asynchronous operations on the caller's
+  // executor, so the handshake never blocks its event loop.
+  template <typename CompletionToken>
+  auto AsyncCheckout(boost::asio::any_io_executor executor,
+                     CompletionToken &&token) {
+    return boost::asio::async_initiate<
+        CompletionToken,
+        void(std::exception_ptr, std::unique_ptr<Connection>, bool)>(
+        [this](auto handler, boost::asio::any_io_executor ex) {
+          Enqueue(Waiter{std::move(ex), Handler{std::move(handler)}});
+        },
+        token, std::move(executor));
+  }
+
+private:
+  struct Waiter {
+    boost::asio::any_io_executor executor;
+    Handler handler;
+  };
+
+  static void Complete(Waiter waiter, std::exception_ptr error,
+                       std::unique_ptr<Connection> connection, bool reused) {
+    boost::asio::post(waiter.executor,
+                      boost::asio::append(std::move(waiter.handler), error,
+                                          std::move(connection), reused));
+  }
+
+  Lease Open() {
+    try {
+      return Lease{*this, make_(), false};
+    } catch (...) {
+      Drop();
+      throw;
+    }
+  }
+
+  void Enqueue(Waiter waiter) {
+    std::unique_lock<std::mutex> lock{mutex_};
+
+    while (!idle_.empty()) {
+      std::unique_ptr<Connection> connection = std::move(idle_.back());
+      idle_.pop_back();
+      lock.unlock();
+
+      if (!Expired(*connection) && connection->Alive()) {
+        Complete(std::move(waiter), nullptr, std::move(connection), true);
+        return;
+      }
+
+      connection.reset();
+      lock.lock();
+      --size_;
+    }
+
+    waiters_.push_back(std::move(waiter));
+    Serve(lock);
+  }
+
+  // Opens a connection for each queued caller that fits under the limit.
+  void Serve(std::unique_lock<std::mutex> &lock) {
+    while (!waiters_.empty() && size_ < max_) {
+      Waiter waiter = std::move(waiters_.front());
+      waiters_.pop_front();
+      ++size_;
+      lock.unlock();
+
+      const boost::asio::any_io_executor executor = waiter.executor;
+      boost::asio::co_spawn(
+          executor, async_make_(),
+          [this, waiter = std::move(waiter)](
+              std::exception_ptr error,
+              std::unique_ptr<Connection> connection) mutable {
+            if (error)
+              Drop();
+            std::move(waiter.handler)(error, std::move(connection), false);
+          });
+
+      lock.lock();
+    }
+  }
+
+  void Return(std::unique_ptr<Connection> connection) {
+    connection->idle_since_ = std::chrono::steady_clock::now();
+    Offer(std::move(connection), true);
+  }
+
+  void Offer(std::unique_ptr<Connection> connection, bool reused) {
+    std::unique_lock<std::mutex> lock{mutex_};
+
+    if (!waiters_.empty()) {
+      Waiter waiter = std::move(waiters_.front());
+      waiters_.pop_front();
+      lock.unlock();
+      Complete(std::move(waiter), nullptr, std::move(connection), reused);
+      return;
+    }
+
+    idle_.push_back(std::move(connection));
+    lock.unlock();
+    cv_.notify_all();
+  }
+
+  void Drop() {
+    {
+      std::unique_lock<std::mutex> lock{mutex_};
+      --size_;
+      Serve(lock);
+    }
+    cv_.notify_all();
+  }
+
+  // A zero idle timeout keeps idle connections until the server closes them.
+  bool Expired(const Connection &connection) const {
+    return idle_timeout_.count() > 0 &&
+           std::chrono::steady_clock::now() - connection.idle_since_ >=
+               idle_timeout_;
+  }
+
+  // Opens connections in the background, closes idle connections before the
+  // server's idle timeout would, and reopens them so the pool keeps min_ warm
+  // connections between requests. Prewarm() asks for one checked, idle
+  // connection to be ready for the next request.
+  void Maintain(std::stop_token stop) {
+    std::unique_lock<std::mutex> lock{mutex_};
+
+    while (!stop.stop_requested()) {
+      std::vector<std::unique_ptr<Connection>> closing;
+      for (auto it = idle_.begin(); it != idle_.end();) {
+        if (Expired(**it)) {
+          closing.push_back(std::move(*it));
+          it = idle_.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      size_ -= closing.size();
+
+      const bool prewarm = std::exchange(prewarm_, false);
+      if (prewarm && !idle_.empty()) {
+        std::unique_ptr<Connection> connection = std::move(idle_.back());
+        idle_.pop_back();
+        lock.unlock();
+        const bool alive = connection->Alive();
+        lock.lock();
+        if (alive) {
+          idle_.push_back(std::move(connection));
+        } else {
+          closing.push_back(std::move(connection));
+          --size_;
+        }
+      }
+
+      std::size_t missing = size_ < min_ ? min_ - size_ : 0;
+      if (prewarm && missing == 0 && idle_.empty())
+        missing = 1;
+      missing = std::min(missing, max_ - size_);
+      size_ += missing;
+      opening_ += missing;
+
+      lock.unlock();
+      closing.clear();
+      for (; missing > 0 && !stop.stop_requested(); --missing) {
+        std::unique_ptr<Connection> connection;
+        try {
+          connection = make_();
+          connection->idle_since_ = std::chrono::steady_clock::now();
+        } catch (...) {
+        }
+
+        lock.lock();
+        --opening_;
+        lock.unlock();
+
+        if (connection) {
+          Offer(std::move(connection), false);
+          continue;
+        }
+
+        Drop();
+
+        --missing;
+        break;
+      }
+      lock.lock();
+      size_ -= missing;
+      opening_ -= missing;
+      Serve(lock);
+
+      const auto requested = [this] { return prewarm_; };
+
+      if (idle_timeout_.count() == 0) {
+        cv_.wait(lock, stop, requested);
+        continue;
+      }
+
+      auto wakeup = std::chrono::steady_clock::now() + idle_timeout_;
+      for (const auto &connection : idle_) {
+        wakeup = std::min(wakeup, connection->idle_since_ + idle_timeout_);
+      }
+      cv_.wait_until(lock, stop, wakeup, requested);
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable_any cv_;
+  std::vector<std::unique_ptr<Connection>> idle_;
+  std::deque<Waiter> waiters_;
+  std::size_t size_ = 0, opening_ = 0;
+  bool prewarm_ = false;
+  const std::size_t max_, min_;
+  const std::chrono::steady_clock::duration idle_timeout_;
+  const std::function<std::unique_ptr<Connection>()> make_;
+  const std::function<
+      boost::asio::awaitable<std::unique_ptr<Connection>>()>
+      async_make_;
+  std::jthread maintainer_;
+};
+
+// Latencies of the most recent requests, used to pick the hedging delay.
+class Latencies {
+public:
+  using clock = std::chrono::steady_clock;
+
+  void Record(clock::duration latency) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    samples_[next_] = latency;
+    next_ = (next_ + 1) % samples_.size();
+    count_ = std::min(count_ + 1, samples_.size());
+  }
+
+  std::optional<clock::duration> Percentile(double percentile,
+                                            std::size_t min_samples) {
+    std::array<clock::duration, 256> sorted;
+    std::size_t count;
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      count = count_;
+      if (count == 0 || count < min_samples)
+        return std::nullopt;
+      std::copy_n(samples_.begin(), count, sorted.begin());
+    }
+
+    const auto rank = static_cast<std::size_t>(
+        std::clamp(percentile, 0.0, 100.0) / 100.0 *
+        static_cast<double>(count - 1));
+    std::nth_element(sorted.begin(), sorted.begin() + rank,
+                     sorted.begin() + count);
+    return sorted[rank];
+  }
+
+private:
+  std::mutex mutex_;
+  std::array<clock::duration, 256> samples_;
+  std::size_t next_ = 0, count_ = 0;
+};
+
+// Lets another thread stop a request by shutting down its socket, but only
+// while the request still owns the connection.
+class Abort {
+public:
+  class Scope {
+  public:
+    Scope(Abort &abort, int socket) : abort_{abort} {
+      std::lock_guard<std::mutex> lock{abort_.mutex_};
+      if (abort_.cancelled_)
+        throw boost::beast::system_error{
+            boost::asio::error::operation_aborted};
+      abort_.socket_ = socket;
+    }
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+    ~Scope() {
+      std::lock_guard<std::mutex> lock{abort_.mutex_};
+      abort_.socket_ = -1;
+    }
+
+  private:
+    Abort &abort_;
+  };
+
+  void Cancel() {
+    std::lock_guard<std::mutex> lock{mutex_};
+    cancelled_ = true;
+    if (socket_ != -1)
+      ::shutdown(socket_, SHUT_RDWR);
+  }
+
+  bool cancelled() {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return cancelled_;
+  }
+
+private:
+  std::mutex mutex_;
+  int socket_ = -1;
+  bool cancelled_ = false;
+};
+
+// Response body parsed as JSON while it arrives. Bodies with gzip or deflate
+// content coding are inflated on the way into the parser, so neither the
+// compressed nor the decompressed text is ever held in full.
+struct JsonBody {
+  using value_type = boost::json::value;
+
+  class reader {
+  public:
+    // The parser builds its reader before any header arrives, so the content
+    // coding is looked at in init().
+    template <bool isRequest, class Fields>
+    reader(boost::beast::http::header<isRequest, Fields> &header,
+           value_type &body)
+        : fields_{header}, body_{body} {}
+
+    reader(const reader &) = delete;
+    reader &operator=(const reader &) = delete;
+
+    ~reader() {
+      if (initialized_)
+        ::inflateEnd(&stream_);
+    }
+
+    void init(const boost::optional<std::uint64_t> &,
+              boost::beast::error_code &ec) {
+      ec = {};
+
+      const auto coding = fields_[boost::beast::http::field::content_encoding];
+      inflate_ = boost::beast::iequals(coding, "gzip") ||
+                 boost::beast::iequals(coding, "deflate");
+
+      // 15 + 32 accepts both the zlib and the gzip framing.
+      if (inflate_) {
+        if (::inflateInit2(&stream_, 15 + 32) != Z_OK) {
+          ec = boost::beast::zlib::error::general;
+          return;
+        }
+        initialized_ = true;
+      }
+    }
+
+    template <class ConstBufferSequence>
+    std::size_t put(const ConstBufferSequence &buffers,
+                    boost::beast::error_code &ec) {
+      std::size_t size = 0;
+
+      for (auto it = boost::asio::buffer_sequence_begin(buffers);
+           it != boost::asio::buffer_sequence_end(buffers); ++it) {
+        const boost::asio::const_buffer buffer = *it;
+
+        if (inflate_)
+          Inflate(buffer, ec);
+        else
+          parser_.write(static_cast<const char *>(buffer.data()),
+                        buffer.size(), ec);
+
+        if (ec)
+          return size;
+
+        size += buffer.size();
+      }
+
+      return size;
+    }
+
+    void finish(boost::beast::error_code &ec) {
+      if (inflate_ && !ended_) {
+        ec = boost::beast::zlib::error::end_of_stream;
+        return;
+      }
+
+      parser_.finish(ec);
+      if (!ec)
+        body_ = parser_.release();
+    }
+
+  private:
+    void Inflate(boost::asio::const_buffer buffer,
+                 boost::beast::error_code &ec) {
+      stream_.next_in =
+          const_cast<Bytef *>(static_cast<const Bytef *>(buffer.data()));
+      stream_.avail_in = static_cast<uInt>(buffer.size());
+
+      do {
+        stream_.next_out = out_.data();
+        stream_.avail_out = static_cast<uInt>(out_.size());
+
+        const int result = ::inflate(&stream_, Z_NO_FLUSH);
+        if (result == Z_STREAM_END) {
+          ended_ = true;
+        } else if (result != Z_OK && result != Z_BUF_ERROR) {
+          ec = boost::beast::zlib::error::general;
+          return;
+        }
+
+        parser_.write(reinterpret_cast<const char *>(out_.data()),
+                      out_.size() - stream_.avail_out, ec);
+        if (ec)
+          return;
+      } while (!ended_ && (stream_.avail_in > 0 || stream_.avail_out == 0));
+    }
+
+    const boost::beast::http::fields &fields_;
+    value_type &body_;
+    boost::json::stream_parser parser_;
+    z_stream stream_{};
+    std::array<Bytef, 16384> out_;
+    bool inflate_ = false, initialized_ = false, ended_ = false;
+  };
+};
+
+// Gzip compressor appending its output to a string. The fastest level is
+// used: JSON text shrinks well even there, and the point is to save upload
+// time without spending more CPU than it saves.
+class Gzip {
+public:
+  explicit Gzip(std::string &out) : out_{out} {
+    if (::deflateInit2(&stream_, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8,
+                       Z_DEFAULT_STRATEGY) != Z_OK)
+      throw boost::beast::system_error{boost::beast::zlib::error::general};
+  }
+
+  Gzip(const Gzip &) = delete;
+  Gzip &operator=(const Gzip &) = delete;
+
+  ~Gzip() { ::deflateEnd(&stream_); }
+
+  void Write(std::string_view data) { Deflate(data, Z_NO_FLUSH); }
+
+  void Finish() { Deflate({}, Z_FINISH); }
+
+private:
+  void Deflate(std::string_view data, int flush) {
+    stream_.next_in =
+        reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    stream_.avail_in = static_cast<uInt>(data.size());
+
+    do {
+      const std::size_t size = out_.size();
+      out_.resize(size + chunk);
+      stream_.next_out = reinterpret_cast<Bytef *>(out_.data() + size);
+      stream_.avail_out = chunk;
+
+      if (::deflate(&stream_, flush) == Z_STREAM_ERROR)
+        throw boost::beast::system_error{boost::beast::zlib::error::general};
+
+      out_.resize(out_.size() - stream_.avail_out);
+    } while (stream_.avail_out == 0);
+  }
+
+  static constexpr uInt chunk = 16384;
+
+  std::string &out_;
+  z_stream stream_{};
+};
+
+// Body of a streaming completion. Beast's parser takes care of the chunked
+// transfer coding and writes the payload into a window that doubles while
+// reads keep filling it; the SSE decoder carries events split between reads
+// over to the next one.
+class EventStream {
+public:
+  using Parser =
+      boost::beast::http::response_parser<boost::beast::http::buffer_body>;
+
+  explicit EventStream(sse::Decoder::Event event)
+      : event_{std::move(event)}, window_(min_window) {
+    parser_.body_limit(boost::none);
+  }
+
+  Parser &parser() { return parser_; }
+
+  bool done() const { return parser_.is_done(); }
+
+  bool keep_alive() const { return parser_.keep_alive(); }
+
+  void CheckStatus() const {
+    if (parser_.get().result() != boost::beast::http::status::ok)
+      throw boost::beast::system_error{boost::beast::http::error::bad_status};
+  }
+
+  // Points the parser at the window before a read.
+  void Prepare() {
+    auto &body = parser_.get().body();
+    body.data = window_.data();
+    body.size = window_.size();
+    body.more = true;
+  }
+
+  // Decodes a body that arrived some other way, such as HTTP/2 frames.
+  void Feed(std::string_view data) { decoder_.Feed(data, event_); }
+
+  // Decodes what the last read left in the window. A full window only means
+  // the parser ran out of room, which is not an error.
+  void Consume(boost::beast::error_code ec) {
+    if (ec && ec != boost::beast::http::error::need_buffer)
+      throw boost::beast::system_error{ec};
+
+    const std::size_t size = window_.size() - parser_.get().body().size;
+
+    decoder_.Feed({window_.data(), size}, event_);
+
+    if (size == window_.size() && window_.size() < max_window)
+      window_.resize(window_.size() * 2);
+  }
+
+private:
+  static constexpr std::size_t min_window = 1024, max_window = 64 * 1024;
+
+  sse::Decoder::Event event_;
+  Parser parser_;
+  sse::Decoder decoder_;
+  std::vector<char> window_;
+};
+
+// Extracts deltas from events without allocating once warmed up. Plain
+// chunks are read straight from the event; the rest go through one parser
+// and one arena that are reused for every event of a stream, and the arena
+// is emptied before each parse.
+class DeltaParser {
+public:
+  using Call = std::function<void(const xai::Delta &)>;
+
+  // Returns false for events without a delta, and throws for an error event.
+  // The delta stays valid until the next call.
+  bool Parse(std::string_view data, xai::Delta &delta) {
+    if (data == "[DONE]")
+      return false;
+
+    if (sse::ExtractDelta(data, delta, scratch_))
+      return true;
+
+    value_.reset();
+    resource_.release();
+    parser_.reset(&resource_);
+    parser_.write(data);
+    parser_.finish();
+
+    const boost::json::value &value = value_.emplace(parser_.release());
+    const boost::json::object &object = value.as_object();
+
+    // A failure after the response headers arrives as an event.
+    if (const boost::json::value *error = object.if_contains("error"))
+      throw boost::beast::system_error{boost::beast::http::error::bad_status,
+                                       Message(*error)};
+
+    const boost::json::value *choices = object.if_contains("choices");
+    if (choices == nullptr || choices->as_array().empty())
+      return false;
+
+    const boost::json::object &choice = choices->as_array()[0].as_object();
+    const boost::json::value *changes = choice.if_contains("delta");
+    const boost::json::object *fields =
+        changes != nullptr ? changes->if_object() : nullptr;
+
+    delta = xai::Delta{String(fields, "content"), String(fields, "role"),
+                       String(&choice, "finish_reason")};
+    return true;
+  }
+
+private:
+  // Absent and null fields, and fields of an absent object, come out empty.
+  static std::string_view String(const boost::json::object *object,
+                                 std::string_view key) {
+    const boost::json::value *value =
+        object != nullptr ? object->if_contains(key) : nullptr;
+    if (value == nullptr || !value->is_string())
+      return {};
+    return value->get_string();
+  }
+
+  static std::string Message(const boost::json::value &error) {
+    if (const boost::json::object *object = error.if_object())
+      if (std::string_view message = String(object, "message");
+          !message.empty())
+        return std::string{message};
+    if (const boost::json::string *message = error.if_string())
+      return std::string{*message};
+    return boost::json::serialize(error);
+  }
+
+  std::string scratch_;
+  unsigned char buffer_[4096];
+  boost::json::monotonic_resource resource_{buffer_, sizeof(buffer_)};
+  boost::json::stream_parser parser_;
+  std::optional<boost::json::value> value_;
+};
+
+// Streaming completion read only as the consumer asks for deltas. Events
+// decoded by a read are queued, reusing their strings, and parsed one at a
+// time. The time the consumer spends between reads does not count against
+// the read timeout.
+class xAIDeltaStream final : public xai::DeltaStream {
+public:
+  xAIDeltaStream(Pool::Lease lease, const xai::Client::Options &options,
+                 Deadline::clock::time_point start,
+                 const std::array<boost::asio::const_buffer, 3> &request)
+      : lease_{std::move(lease)},
+        body_{[this](std::string_view data) { Queue(data); }} {
+    deadline_.emplace(options, start, lease_->native_handle());
+
+    try {
+      boost::asio::write(lease_->stream_, request);
+
+      boost::beast::http::read_header(lease_->stream_, buffer_,
+                                      body_.parser());
+      deadline_->Touch();
+      body_.CheckStatus();
+    } catch (const boost::beast::system_error &) {
+      deadline_->Check();
+      throw;
+    }
+
+    deadline_->Pause();
+  }
+
+  ~xAIDeltaStream() final = default;
+
+  const xai::Delta *Next() final {
+    try {
+      return Advance();
+    } catch (...) {
+      // A failed stream is over: later calls return nullptr, and the
+      // connection is closed rather than reused.
+      deadline_.reset();
+      next_ = count_ = 0;
+      throw;
+    }
+  }
+
+private:
+  const xai::Delta *Advance() {
+    for (;;) {
+      while (next_ < count_) {
+        if (deltas_.Parse(events_[next_++], delta_))
+          return &delta_;
+      }
+      next_ = count_ = 0;
+
+      if (!deadline_)
+        return nullptr;
+
+      if (body_.done()) {
+        // The deadline watches the socket, so it goes before the connection
+        // is handed back.
+        deadline_.reset();
+        if (body_.keep_alive())
+          lease_.Recycle();
+        return nullptr;
+      }
+
+      Read();
+    }
+  }
+
+  void Queue(std::string_view data) {
+    if (count_ == events_.size())
+      events_.emplace_back();
+    events_[count_++].assign(data);
+  }
+
+  void Read() {
+    deadline_->Touch();
+
+    try {
+      boost::beast::error_code ec;
+
+      body_.Prepare();
+      boost::beast::http::read_some(lease_->stream_, buffer_, body_.parser(),
+                                    ec);
+      deadline_->Touch();
+      body_.Consume(ec);
+    } catch (const boost::beast::system_error &) {
+      deadline_->Check();
+      throw;
+    }
+
+    deadline_->Pause();
+  }
+
+  Pool::Lease lease_;
+  std::optional<Deadline> deadline_;
+  EventStream body_;
+  boost::beast::flat_buffer buffer_;
+  DeltaParser deltas_;
+  xai::Delta delta_;
+  std::vector<std::string> events_;
+  std::size_t next_ = 0, count_ = 0;
+};
+
+#ifdef XAI_HTTP2
+// One HTTP/2 connection carrying any number of streaming completions at once.
+// nghttp2 runs on a strand of the client's executor, which reads the socket
+// and writes whatever frames the session has queued, while each caller waits
+// on its own stream. Data is only acknowledged with WINDOW_UPDATE once its
+// caller has taken it, so the flow-control windows bound how far the server
+// can get ahead of a slow consumer, per stream and for the connection.
+class Http2Session : public std::enable_shared_from_this<Http2Session> {
+  struct Stream;
+
+public:
+  class Exchange;
+
+  static std::shared_ptr<Http2Session>
+  Make(const boost::asio::any_io_executor &executor,
+       std::unique_ptr<Connection> connection, std::string authority,
+       std::string authorization, const xai::Client::Options &options) {
+    std::shared_ptr<Http2Session> session{
+        new Http2Session{executor, std::move(connection), std::move(authority),
+                         std::move(authorization)}};
+    session->Start(options);
+    return session;
+  }
+
+  Http2Session(const Http2Session &) = delete;
+  Http2Session &operator=(const Http2Session &) = delete;
+
+  ~Http2Session() { nghttp2_session_del(session_); }
+
+  // What a stream closed with the HTTP/2 error `code` reports. A refused
+  // stream was never processed, so the caller may send it again.
+  static boost::beast::error_code Error(std::uint32_t code) {
+    if (code == NGHTTP2_REFUSED_STREAM)
+      return boost::asio::error::try_again;
+    return boost::asio::error::connection_reset;
+  }
+
+  // False once the connection failed or the server asked for no new streams
+  // on it.
+  bool open() const { return !closed_.load(std::memory_order_acquire); }
+
+  // Ends the read loop, which fails the streams still open.
+  void Close() { ::shutdown(connection_->native_handle(), SHUT_RDWR); }
+
+private:
+  // One request and its response. The strand fills the response in and the
+  // caller takes it out, under the mutex.
+  struct Stream {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::string data;
+    unsigned status = 0;
+    bool closed = false, woken = false;
+    boost::beast::error_code ec;
+
+    // Only used on the strand.
+    std::int32_t id = 0;
+    std::string body;
+    std::size_t sent = 0, received = 0, consumed = 0;
+    bool compressed = false;
+  };
+
+  Http2Session(const boost::asio::any_io_executor &executor,
+               std::unique_ptr<Connection> connection, std::string authority,
+               std::string authorization)
+      : strand_{boost::asio::make_strand(executor)},
+        connection_{std::move(connection)}, authority_{std::move(authority)},
+        authorization_{std::move(authorization)} {}
+
+  // Windows are limited to 2^31 - 1 bytes.
+  static std::int32_t Window(std::size_t size) {
+    return static_cast<std::int32_t>(
+        std::min<std::size_t>(size, 0x7fffffff));
+  }
+
+  // Setting a session up only fails when memory runs out.
+  static void Check(int result) {
+    if (result < 0)
+      throw boost::beast::system_error{boost::asio::error::no_memory};
+  }
+
+  void Start(const xai::Client::Options &options) {
+    nghttp2_session_callbacks *callbacks = nullptr;
+    Check(nghttp2_session_callbacks_new(&callbacks));
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, OnHeader);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks,
+                                                              OnData);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, OnFrame);
+    nghttp2_session_callbacks_set_on_frame_not_send_callback(callbacks,
+                                                             OnNotSent);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, OnClose);
+
+    // Windows are only opened again as callers consume their data.
+    nghttp2_option *option = nullptr;
+    const int result = nghttp2_option_new(&option);
+    if (result == 0) {
+      nghttp2_option_set_no_auto_window_update(option, 1);
+      Check(nghttp2_session_client_new2(&session_, callbacks, this, option));
+      nghttp2_option_del(option);
+    }
+    nghttp2_session_callbacks_del(callbacks);
+    Check(result);
+
+    const std::array<nghttp2_settings_entry, 2> settings{{
+        {NGHTTP2_SETTINGS_ENABLE_PUSH, 0},
+        {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE,
+         static_cast<std::uint32_t>(Window(options.http2_stream_window))},
+    }};
+    Check(nghttp2_submit_settings(session_, NGHTTP2_FLAG_NONE, settings.data(),
+                                  settings.size()));
+    Check(nghttp2_session_set_local_window_size(
+        session_, NGHTTP2_FLAG_NONE, 0,
+        Window(options.http2_connection_window)));
+
+    boost::asio::co_spawn(
+        strand_, Receive(),
+        [self = shared_from_this()](std::exception_ptr error) {
+          if (error)
+            self->Fail(boost::asio::error::connection_aborted);
+        });
+  }
+
+  void Submit(std::shared_ptr<Stream> stream) {
+    boost::asio::post(strand_, [this, self = shared_from_this(),
+                                stream = std::move(stream)]() mutable {
+      // Refused streams were never seen by the server, so the caller can
+      // send them again elsewhere.
+      if (broken_) {
+        Finish(*stream, Error(NGHTTP2_REFUSED_STREAM));
+        return;
+      }
+
+      const std::string length = std::to_string(stream->body.size());
+      std::vector<nghttp2_nv> fields{
+          Field(":method", "POST"),
+          Field(":scheme", "https"),
+          Field(":authority", authority_),
+          Field(":path", "/v1/chat/completions"),
+          Field("content-type", Server::content_type),
+          Field("authorization", authorization_, NGHTTP2_NV_FLAG_NO_INDEX),
+          Field("user-agent", Server::user_agent),
+          Field("accept", "text/event-stream"),
+          Field("content-length", length),
+      };
+      if (stream->compressed)
+        fields.push_back(Field("content-encoding", "gzip"));
+
+      nghttp2_data_provider body{};
+      body.source.ptr = stream.get();
+      body.read_callback = ReadBody;
+
+      const std::int32_t id = nghttp2_submit_request(
+          session_, nullptr, fields.data(), fields.size(), &body, stream.get());
+      if (id < 0) {
+        // Out of stream identifiers, most likely: a new session takes over.
+        closed_.store(true, std::memory_order_release);
+        Finish(*stream, Error(NGHTTP2_REFUSED_STREAM));
+        return;
+      }
+
+      stream->id = id;
+      streams_.emplace(id, std::move(stream));
+      Flush();
+    });
+  }
+
+  // Hands window back once the caller is done with `size` bytes of data.
+  void Consume(std::shared_ptr<Stream> stream, std::size_t size) {
+    boost::asio::post(strand_, [this, self = shared_from_this(),
+                                stream = std::move(stream), size] {
+      if (!streams_.contains(stream->id))
+        return;
+      nghttp2_session_consume(session_, stream->id, size);
+      stream->consumed += size;
+      Flush();
+    });
+  }
+
+  void Reset(std::shared_ptr<Stream> stream) {
+    boost::asio::post(strand_, [this, self = shared_from_this(),
+                                stream = std::move(stream)] {
+      if (!streams_.contains(stream->id))
+        return;
+      nghttp2_submit_rst_stream(session_, NGHTTP2_FLAG_NONE, stream->id,
+                                NGHTTP2_CANCEL);
+      Flush();
+    });
+  }
+
+  boost::asio::awaitable<void> Receive() {
+    Flush();
+
+    std::array<std::uint8_t, 16384> buffer;
+    boost::beast::error_code ec;
+    for (;;) {
+      const std::size_t size = co_await connection_->stream_.async_read_some(
+          boost::asio::buffer(buffer),
+          boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+      if (ec)
+        break;
+
+      // Only a protocol violation makes the session give up.
+      if (nghttp2_session_mem_recv(session_, buffer.data(), size) < 0) {
+        ec = boost::asio::error::connection_aborted;
+        break;
+      }
+
+      Flush();
+      if (!nghttp2_session_want_read(session_) &&
+          !nghttp2_session_want_write(session_))
+        break;
+    }
+
+    Fail(ec ? ec : boost::asio::error::eof);
+  }
+
+  // Writes everything the session has queued, one write at a time.
+  void Flush() {
+    if (writing_ || broken_)
+      return;
+
+    output_.clear();
+    for (;;) {
+      const std::uint8_t *data = nullptr;
+      const ssize_t size = nghttp2_session_mem_send(session_, &data);
+      if (size < 0) {
+        Fail(boost::asio::error::connection_aborted);
+        return;
+      }
+      if (size == 0)
+        break;
+      output_.append(reinterpret_cast<const char *>(data),
+                     static_cast<std::size_t>(size));
+    }
+    if (output_.empty())
+      return;
+
+    writing_ = true;
+    boost::asio::async_write(
+        connection_->stream_, boost::asio::buffer(output_),
+        boost::asio::bind_executor(
+            strand_, [this, self = shared_from_this()](
+                         boost::beast::error_code ec, std::size_t) {
+              writing_ = false;
+              if (ec)
+                Fail(ec);
+              else
+                Flush();
+            }));
+  }
+
+  // The connection is unusable: every open stream fails with `ec`.
+  void Fail(boost::beast::error_code ec) {
+    if (broken_)
+      return;
+    broken_ = true;
+    closed_.store(true, std::memory_order_release);
+    Close();
+
+    for (auto &[id, stream] : streams_) {
+      Finish(*stream, ec);
+    }
+    streams_.clear();
+  }
+
+  static void Finish(Stream &stream, boost::beast::error_code ec) {
+    {
+      std::lock_guard<std::mutex> lock{stream.mutex};
+      stream.closed = true;
+      stream.ec = ec;
+    }
+    stream.cv.notify_all();
+  }
+
+  static nghttp2_nv Field(std::string_view name, std::string_view value,
+                          std::uint8_t flags = NGHTTP2_NV_FLAG_NONE) {
+    return {const_cast<std::uint8_t *>(
+                reinterpret_cast<const std::uint8_t *>(name.data())),
+            const_cast<std::uint8_t *>(
+                reinterpret_cast<const std::uint8_t *>(value.data())),
+            name.size(), value.size(), flags};
+  }
+
+  static ssize_t ReadBody(nghttp2_session *, std::int32_t,
+                          std::uint8_t *buffer, std::size_t length,
+                          std::uint32_t *flags, nghttp2_data_source *source,
+                          void *) {
+    Stream &stream = *static_cast<Stream *>(source->ptr);
+
+    const std::size_t size = std::min(length, stream.body.size() - stream.sent);
+    std::copy_n(stream.body.data() + stream.sent, size, buffer);
+    stream.sent += size;
+    if (stream.sent == stream.body.size())
+      *flags |= NGHTTP2_DATA_FLAG_EOF;
+
+    return static_cast<ssize_t>(size);
+  }
+
+  static int OnHeader(nghttp2_session *session, const nghttp2_frame *frame,
+                      const std::uint8_t *name, std::size_t name_size,
+                      const std::uint8_t *value, std::size_t value_size,
+                      std::uint8_t, void *) {
+    if (frame->hd.type != NGHTTP2_HEADERS ||
+        std::string_view{reinterpret_cast<const char *>(name), name_size} !=
+            ":status")
+      return 0;
+
+    auto *stream = static_cast<Stream *>(
+        nghttp2_session_get_stream_user_data(session, frame->hd.stream_id));
+    if (stream == nullptr)
+      return 0;
+
+    // Interim 1xx responses come before the one that counts.
+    const char *first = reinterpret_cast<const char *>(value);
+    unsigned status = 0;
+    std::from_chars(first, first + value_size, status);
+    if (status < 200)
+      return 0;
+
+    {
+      std::lock_guard<std::mutex> lock{stream->mutex};
+      stream->status = status;
+    }
+    stream->cv.notify_all();
+
+    return 0;
+  }
+
+  static int OnData(nghttp2_session *session, std::uint8_t, std::int32_t id,
+                    const std::uint8_t *data, std::size_t size, void *) {
+    auto *stream = static_cast<Stream *>(
+        nghttp2_session_get_stream_user_data(session, id));
+    if (stream == nullptr) {
+      nghttp2_session_consume(session, id, size);
+      return 0;
+    }
+
+    stream->received += size;
+    {
+      std::lock_guard<std::mutex> lock{stream->mutex};
+      stream->data.append(reinterpret_cast<const char *>(data), size);
+    }
+    stream->cv.notify_all();
+
+    return 0;
+  }
+
+  static int OnFrame(nghttp2_session *, const nghttp2_frame *frame,
+                     void *user_data) {
+    if (frame->hd.type == NGHTTP2_GOAWAY)
+      static_cast<Http2Session *>(user_data)->closed_.store(
+          true, std::memory_order_release);
+    return 0;
+  }
+
+  static int OnNotSent(nghttp2_session *session, const nghttp2_frame *frame,
+                       int, void *user_data) {
+    // A request the session would not start, after a GOAWAY for instance.
+    if (frame->hd.type == NGHTTP2_HEADERS)
+      OnClose(session, frame->hd.stream_id, NGHTTP2_REFUSED_STREAM, user_data);
+    return 0;
+  }
+
+  static int OnClose(nghttp2_session *session, std::int32_t id,
+                     std::uint32_t error, void *user_data) {
+    Http2Session &self = *static_cast<Http2Session *>(user_data);
+
+    const auto it = self.streams_.find(id);
+    if (it == self.streams_.end())
+      return 0;
+
+    // Data the caller will not hand back any more still holds on to the
+    // connection's window.
+    Stream &stream = *it->second;
+    nghttp2_session_consume_connection(session,
+                                       stream.received - stream.consumed);
+    Finish(stream, error == NGHTTP2_NO_ERROR ? boost::beast::error_code{}
+                                             : Error(error));
+    self.streams_.erase(it);
+
+    return 0;
+  }
+
+  boost::asio::strand<boost::asio::any_io_executor> strand_;
+  std::unique_ptr<Connection> connection_;
+  const std::string authority_, authorization_;
+  nghttp2_session *session_ = nullptr;
+  std::unordered_map<std::int32_t, std::shared_ptr<Stream>> streams_;
+  std::string output_;
+  bool writing_ = false, broken_ = false;
+  std::atomic<bool> closed_{false};
+};
+
+// A request on the session, from the caller's side. Dropping it before the
+// response is over resets the stream.
+class Http2Session::Exchange {
+public:
+  Exchange(std::shared_ptr<Http2Session> session, std::string body,
+           bool compressed)
+      : session_{std::move(session)}, stream_{std::make_shared<Stream>()} {
+    stream_->body = std::move(body);
+    stream_->compressed = compressed;
+    session_->Submit(stream_);
+  }
+
+  Exchange(const Exchange &) = delete;
+  Exchange &operator=(const Exchange &) = delete;
+
+  ~Exchange() {
+    if (!over_)
+      session_->Reset(stream_);
+  }
+
+  // Waits for the status of the response, or returns 0 once woken up.
+  unsigned Status() {
+    std::unique_lock<std::mutex> lock{stream_->mutex};
+    stream_->cv.wait(lock, [this] {
+      return stream_->status != 0 || stream_->closed || stream_->woken;
+    });
+
+    if (stream_->status != 0 || stream_->woken)
+      return stream_->woken ? 0 : stream_->status;
+
+    over_ = true;
+    throw boost::beast::system_error{
+        stream_->ec ? stream_->ec : boost::beast::http::error::partial_message};
+  }
+
+  // Swaps the data received since the last call into `data`, waiting for
+  // some. Returns false at the end of the response or once woken up.
+  bool Read(std::string &data) {
+    std::unique_lock<std::mutex> lock{stream_->mutex};
+    stream_->cv.wait(lock, [this] {
+      return !stream_->data.empty() || stream_->closed || stream_->woken;
+    });
+
+    if (stream_->woken)
+      return false;
+
+    if (!stream_->data.empty()) {
+      data.clear();
+      data.swap(stream_->data);
+      return true;
+    }
+
+    over_ = true;
+    if (stream_->ec)
+      throw boost::beast::system_error{stream_->ec};
+    return false;
+  }
+
+  void Consume(std::size_t size) { session_->Consume(stream_, size); }
+
+  // Makes a waiting Status or Read return, from any thread.
+  void Wake() {
+    {
+      std::lock_guard<std::mutex> lock{stream_->mutex};
+      stream_->woken = true;
+    }
+    stream_->cv.notify_all();
+  }
+
+private:
+  std::shared_ptr<Http2Session> session_;
+  std::shared_ptr<Stream> stream_;
+  bool over_ = false;
+};
+#endif
+
+class xAIClient final : public xai::Client {
+public:
+  // A request is a prebuilt header block plus, for completions, the messages
+  // that are serialized into the connection's buffer when it is sent.
+  // Asynchronous requests outlive the call that made them, so they keep
+  // their own copy of the messages.
+  struct Request {
+    const std::string *head;
+    const xAIMessages *messages = nullptr;
+    bool stream = false;
+    std::shared_ptr<const xAIMessages> copy = nullptr;
+
+    bool idempotent() const { return messages == nullptr; }
+  };
+
+  using Response = boost::beast::http::response<JsonBody>;
+  using Call = std::function<void(std::unique_ptr<xai::Choices>)>;
+
+  explicit xAIClient(const char *apikey, const char *host = default_host,
+                     const Options &options = {},
+                     boost::asio::any_io_executor executor = {})
+      : io_context_{}, work_{io_context_.get_executor()},
+        executor_{executor ? std::move(executor)
+                           : boost::asio::any_io_executor{
+                                 io_context_.get_executor()}},
+        external_{executor_ != io_context_.get_executor()},
+        ssl_context_{options.transport == Transport::tls
+                         ? TlsContexts::Instance().Acquire(options.ca_file)
+                         : nullptr},
+        host_{host}, options_{options},
+        pool_{options.pool_min, options.pool_max, options.idle_timeout,
+              [this] {
+                return std::make_unique<Connection>(
+                    executor_, ssl_context_.get(), host_, options_);
+              },
+              [this] {
+                return Connection::AsyncOpen(executor_, ssl_context_.get(),
+                                             host_, options_);
+              }} {
+    if (!options.session_file.empty())
+      SessionCache::Instance().Persist(options.session_file);
+
+    authorization_.reserve(135);
+    authorization_.assign("Bearer ", 7);
+    authorization_.append(apikey);
+
+    const std::string accept_encoding =
+        std::string{"Accept-Encoding: "} + Server::accept_encoding + "\r\n";
+
+    chat_head_ = Head("POST /v1/chat/completions", accept_encoding);
+    stream_head_ = Head("POST /v1/chat/completions",
+                        "Accept: text/event-stream\r\n"
+                        "Connection: keep-alive\r\n");
+    models_head_ = Head("GET /v1/models", accept_encoding);
+    language_models_head_ = Head("GET /v1/language-models", accept_encoding);
+
+    pool_.WarmUp(options.background_connect);
+  }
+
+  ~xAIClient() final {
+#ifdef XAI_HTTP2
+    if (http2_)
+      http2_->Close();
+#endif
+    work_.reset();
+  }
+
+  std::unique_ptr<xai::Choices>
+  ChatCompletion(const std::unique_ptr<xai::Messages> &messages) final {
+    // A hedged request may still be serialized by the losing attempt after
+    // the call returns, so it works on a copy of the messages. Hedging runs on
+    // the executor, so a call from one of its own threads, which would wait
+    // on itself, sends the request unhedged on this thread instead.
+    Response response =
+        options_.hedge_percentile > 0 && !RunningInExecutor()
+            ? Hedge(AsyncChatRequest(*messages, false), boost::asio::use_future)
+                  .get()
+            : Do(ChatRequest(*messages, false));
+
+    return std::make_unique<xAIContentChoices>(Parse(response));
+  }
+
+  void ChatCompletion(const std::unique_ptr<xai::Messages> &messages,
+                      const Call &call) final {
+    ChatCompletion(messages, call, std::stop_token{});
+  }
+
+  void ChatCompletion(const std::unique_ptr<xai::Messages> &messages,
+                      const Call &call, std::stop_token stop) final {
+    EventStream events{ChoicesEvents(call)};
+
+    StreamEvents(ChatRequest(*messages, true), events, std::move(stop));
+  }
+
+  void StreamChatCompletion(const std::unique_ptr<xai::Messages> &messages,
+                            const DeltaParser::Call &call,
+                            std::stop_token stop) final {
+    DeltaParser deltas;
+    xai::Delta delta;
+    EventStream events{[&](std::string_view data) {
+      if (deltas.Parse(data, delta))
+        call(delta);
+    }};
+
+    StreamEvents(ChatRequest(*messages, true), events, std::move(stop));
+  }
+
+  std::unique_ptr<xai::DeltaStream>
+  StreamChatCompletion(const std::unique_ptr<xai::Messages> &messages) final {
+    const auto start = Deadline::clock::now();
+
+    Pool::Lease lease = pool_.Checkout();
+    const auto request = Prepare(*lease, ChatRequest(*messages, true));
+
+    return std::make_unique<xAIDeltaStream>(std::move(lease), options_, start,
+                                            request);
+  }
+
+  std::vector<std::unique_ptr<xai::Choices>>
+  ChatCompletion(std::span<const std::unique_ptr<xai::Messages>> batch) final {
+    std::vector<Request> requests;
+    requests.reserve(batch.size());
+    for (const auto &messages : batch) {
+      requests.push_back(ChatRequest(*messages, false));
+    }
+
+    std::vector<std::unique_ptr<xai::Choices>> choices;
+    choices.reserve(batch.size());
+    for (Response &response : Pipeline(requests)) {
+      choices.push_back(std::make_unique<xAIContentChoices>(Parse(response)));
+    }
+
+    return choices;
+  }
+
+  void Prewarm() final { pool_.Prewarm(); }
+
+  bool KernelTlsActive() final {
+    Pool::Lease lease = pool_.Checkout();
+    const AnyStream::Ktls *ktls = lease->stream_.get_if<AnyStream::Ktls>();
+    const bool active = ktls != nullptr && ktls->offloaded();
+    lease.Recycle();
+    return active;
+  }
+
+  std::unique_ptr<xai::ModelList> ListModels() final {
+    Request request = GetRequest(models_head_);
+
+    Response response = Do(request);
+
+    return std::make_unique<xAIModelList>(Parse(response));
+  }
+
+  std::unique_ptr<xai::LanguageModelList> ListLanguageModels() final {
+    Request request = GetRequest(language_models_head_);
+
+    Response response = Do(request);
+
+    return std::make_unique<xAILanguageModelList>(Parse(response));
+  }
+
+protected:
+  void InitiateChatCompletion(const xai::Messages &messages,
+                              ChoicesHandler handler) final {
+    boost::asio::co_spawn(Executor(),
+                          Completion(AsyncChatRequest(messages, false)),
+                          std::move(handler));
+  }
+
+  void InitiateChatCompletion(const xai::Messages &messages, Call call,
+                              StreamHandler handler) final {
+    boost::asio::co_spawn(
+        Executor(),
+        Streaming(AsyncChatRequest(messages, true), std::move(call)),
+        std::move(handler));
+  }
+
+  void InitiateListModels(ModelListHandler handler) final {
+    boost::asio::co_spawn(Executor(), Models(), std::move(handler));
+  }
+
+  void InitiateListLanguageModels(LanguageModelListHandler handler) final {
+    boost::asio::co_spawn(Executor(), LanguageModels(), std::move(handler));
+  }
+
+private:
+  boost::asio::io_context io_context_;
+  boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
+      work_;
+  const boost::asio::any_io_executor executor_;
+  const bool external_;
+  std::shared_ptr<boost::asio::ssl::context> ssl_context_;
+  std::string host_;
+  std::string authorization_;
+  std::string chat_head_, stream_head_, models_head_, language_models_head_;
+  const Options options_;
+  Pool pool_;
+  Latencies latencies_;
+  std::once_flag worker_once_;
+  std::jthread worker_;
+#ifdef XAI_HTTP2
+  std::mutex http2_mutex_;
+  std::shared_ptr<Http2Session> http2_;
+  bool http1_ = false;
+#endif
+
+  // Asynchronous operations run on the caller's executor when the client was
+  // made with one, otherwise on a worker thread started on first use so that
+  // clients which only make blocking calls do not pay for it.
+  // Whether this thread is running the executor, for the executor types
+  // that can tell.
+  bool RunningInExecutor() const {
+    using IoExecutor = boost::asio::io_context::executor_type;
+    if (const auto *io = executor_.target<IoExecutor>())
+      return io->running_in_this_thread();
+    if (const auto *strand =
+            executor_.target<boost::asio::strand<IoExecutor>>())
+      return strand->running_in_this_thread();
+    if (const auto *pool =
+            executor_.target<boost::asio::thread_pool::executor_type>())
+      return pool->running_in_this_thread();
+    return false;
+  }
+
+  const boost::asio::any_io_executor &Executor() {
+    if (!external_) {
+      std::call_once(worker_once_, [this] {
+        worker_ = std::jthread{[this] { io_context_.run(); }};
+      });
+    }
+    return executor_;
+  }
+
+  // The server as Host names it, with the port unless it is the default.
+  std::string Authority() const {
+    std::string authority = host_;
+    if (options_.transport != Transport::local &&
+        options_.port !=
+            (options_.transport == Transport::tls ? "443" : "80"))
+      authority.append(":").append(options_.port);
+    return authority;
+  }
+
+  // The header fields that never change for a given request line.
+  std::string Head(std::string_view line, std::string_view fields) const {
+    std::string head;
+    head.append(line).append(" HTTP/1.1\r\nHost: ").append(Authority());
+    head.append("\r\nContent-Type: ").append(Server::content_type);
+    head.append("\r\nAuthorization: ").append(authorization_);
+    head.append("\r\nUser-Agent: ").append(Server::user_agent);
+    head.append("\r\n").append(fields);
+    return head;
+  }
+
+  Request ChatRequest(const xai::Messages &messages, bool stream) {
+    return {stream ? &stream_head_ : &chat_head_,
+            &static_cast<const xAIMessages &>(messages), stream};
+  }
+
+  Request AsyncChatRequest(const xai::Messages &messages, bool stream) {
+    const auto &source = static_cast<const xAIMessages &>(messages);
+
+    auto copy = std::make_shared<xAIMessages>(source.model_);
+    copy->messages_ = source.messages_;
+
+    Request request = ChatRequest(*copy, stream);
+    request.copy = std::move(copy);
+    return request;
+  }
+
+  Request GetRequest(const std::string &head) { return {&head}; }
+
+  // Lays out a request for one gather write: the prebuilt header block, the
+  // length fields and the body, which is serialized straight into the
+  // connection's buffer.
+  std::array<boost::asio::const_buffer, 3> Prepare(Connection &connection,
+                                                   const Request &request) {
+    std::string &fields = connection.fields_;
+    fields.clear();
+
+    if (request.messages) {
+      const bool compressed =
+          Serialize(*request.messages, request.stream, connection.body_,
+                    connection.spare_);
+
+      fields.append("Content-Length: ")
+          .append(std::to_string(connection.body_.size()))
+          .append("\r\n");
+      if (compressed)
+        fields.append("Content-Encoding: gzip\r\n");
+    } else {
+      connection.body_.clear();
+    }
+    fields.append("\r\n");
+
+    return {boost::asio::buffer(*request.head), boost::asio::buffer(fields),
+            boost::asio::buffer(connection.body_)};
+  }
+
+  // Serializes a completion request into `body` a piece at a time. Once it
+  // grows past compress_threshold the rest goes through gzip into `spare`
+  // as it is produced, and the two buffers swap. Returns whether the body
+  // is compressed.
+  bool Serialize(const xAIMessages &messages, bool stream, std::string &body,
+                 std::string &spare) const {
+    static constexpr std::size_t chunk = 16384;
+    const std::size_t threshold = options_.compress_threshold;
+
+    body.assign("{\"model\":");
+    body.append(boost::json::serialize(boost::json::value(messages.model_)));
+    body.append(stream ? ",\"stream\":true" : ",\"stream\":false");
+    body.append(",\"temperature\":0,\"messages\":");
+
+    boost::json::serializer serializer;
+    serializer.reset(&messages.messages_);
+
+    while (!serializer.done() && (threshold == 0 || body.size() < threshold)) {
+      body.resize_and_overwrite(
+          body.size() + chunk, [&](char *data, std::size_t size) {
+            return size - chunk +
+                   serializer.read(data + size - chunk, chunk).size();
+          });
+    }
+
+    if (threshold == 0 || (serializer.done() && body.size() < threshold)) {
+      body.push_back('}');
+      return false;
+    }
+
+    spare.clear();
+    {
+      Gzip gzip{spare};
+      gzip.Write(body);
+
+      std::array<char, chunk> buffer;
+      while (!serializer.done()) {
+        gzip.Write(serializer.read(buffer.data(), buffer.size()));
+      }
+      gzip.Write("}");
+      gzip.Finish();
+    }
+    body.swap(spare);
+
+    return true;
+  }
+
+  static boost::json::object Parse(Response &response) {
+    return std::move(response.body().as_object());
+  }
+
+  // Hands every event of a stream to `call` as a Choices. Only events that
+  // are not plain chunks are parsed into a document.
+  static sse::Decoder::Event ChoicesEvents(const Call &call) {
+    return [&call, delta = xai::Delta{},
+            scratch = std::string{}](std::string_view data) mutable {
+      if (data == "[DONE]")
+        return;
+
+      if (sse::ExtractDelta(data, delta, scratch)) {
+        call(std::make_unique<xAITextChoices>(std::string{delta.content}));
+        return;
+      }
+
+      boost::json::value value = boost::json::parse(data);
+
+      call(std::make_unique<xAIDeltaChoices>(std::move(value.as_object())));
+    };
+  }
+
+  // Sends a streaming request and feeds its body to `events` until the
+  // response is over or a stop is requested.
+  void StreamEvents(const Request &request, EventStream &events,
+                    std::stop_token stop) {
+    const auto start = Deadline::clock::now();
+
+    if (stop.stop_requested())
+      return;
+
+#ifdef XAI_HTTP2
+    if (StreamHttp2(request, events, stop, start))
+      return;
+#endif
+
+    Pool::Lease lease = pool_.Checkout();
+
+    {
+      // The deadline and the abort watch the socket, so they go before the
+      // connection is handed back.
+      Deadline deadline{options_, start, lease->native_handle()};
+      boost::beast::flat_buffer buffer;
+
+      // A stop request shuts the socket down, which wakes up a blocked read.
+      Abort abort;
+      Abort::Scope scope{abort, lease->native_handle()};
+      std::stop_callback cancel{stop, [&abort] { abort.Cancel(); }};
+
+      try {
+        boost::asio::write(lease->stream_, Prepare(*lease, request));
+
+        boost::beast::http::read_header(lease->stream_, buffer,
+                                        events.parser());
+        deadline.Touch();
+        events.CheckStatus();
+
+        while (!events.done() && !stop.stop_requested()) {
+          boost::beast::error_code ec;
+
+          events.Prepare();
+          boost::beast::http::read_some(lease->stream_, buffer,
+                                        events.parser(), ec);
+          deadline.Touch();
+          events.Consume(ec);
+        }
+      } catch (const boost::beast::system_error &) {
+        if (abort.cancelled())
+          return;
+        deadline.Check();
+        throw;
+      }
+
+      if (abort.cancelled())
+        return;
+    }
+
+    if (events.done() && events.keep_alive())
+      lease.Recycle();
+  }
+
+#ifdef XAI_HTTP2
+  // The session streaming requests share, opened on first use. Null when
+  // HTTP/2 is off or not possible, or the server picked HTTP/1.1 instead,
+  // which then carries every request. A caller on the executor's own thread
+  // would wait on the session's I/O, so it stays on HTTP/1.1 too.
+  std::shared_ptr<Http2Session> Http2() {
+    if (!options_.http2 || options_.transport != Transport::tls ||
+        RunningInExecutor())
+      return nullptr;
+
+    std::lock_guard<std::mutex> lock{http2_mutex_};
+    if (http1_)
+      return nullptr;
+    if (http2_ && http2_->open())
+      return http2_;
+
+    auto connection = std::make_unique<Connection>(
+        executor_, ssl_context_.get(), host_, options_, true);
+    if (connection->Protocol() != "h2") {
+      http1_ = true;
+      return nullptr;
+    }
+
+    http2_ = Http2Session::Make(Executor(), std::move(connection), Authority(),
+                                authorization_, options_);
+    return http2_;
+  }
+
+  // Streams over the shared HTTP/2 session. Returns false to leave the
+  // request to HTTP/1.1. A stream the server refused, such as one caught by
+  // a GOAWAY, was never processed, so it goes out once more on a new
+  // session.
+  bool StreamHttp2(const Request &request, EventStream &events,
+                   const std::stop_token &stop,
+                   Deadline::clock::time_point start) {
+    std::shared_ptr<Http2Session> session = Http2();
+    if (!session)
+      return false;
+
+    std::string body, spare;
+    const bool compressed =
+        Serialize(*request.messages, true, body, spare);
+
+    for (bool retried = false; session; session = Http2()) {
+      try {
+        Http2Session::Exchange exchange{std::move(session), body, compressed};
+        Deadline deadline{options_, start, [&exchange] { exchange.Wake(); }};
+        std::stop_callback cancel{stop, [&exchange] { exchange.Wake(); }};
+
+        if (const unsigned status = exchange.Status(); status != 0) {
+          deadline.Touch();
+          if (status != 200)
+            throw boost::beast::system_error{
+                boost::beast::http::error::bad_status};
+
+          std::string data;
+          while (exchange.Read(data)) {
+            deadline.Touch();
+            events.Feed(data);
+            exchange.Consume(data.size());
+          }
+        }
+
+        if (!stop.stop_requested())
+          deadline.Check();
+        return true;
+      } catch (const boost::beast::system_error &e) {
+        if (retried || e.code() != Http2Session::Error(NGHTTP2_REFUSED_STREAM))
+          throw;
+        retried = true;
+      }
+    }
+
+    return false;
+  }
+#endif
+
+  // Reads one response a piece at a time so that every read counts as
+  // progress against the deadline.
+  template <typename Stream>
+  static Response Read(Stream &stream, boost::beast::flat_buffer &buffer,
+                       Deadline &deadline) {
+    boost::beast::http::response_parser<JsonBody> parser;
+
+    while (!parser.is_done()) {
+      boost::beast::http::read_some(stream, buffer, parser);
+      deadline.Touch();
+    }
+
+    return parser.release();
+  }
+
+  template <typename Stream>
+  static boost::asio::awaitable<Response>
+  AsyncRead(Stream &stream, boost::beast::flat_buffer &buffer,
+            Deadline &deadline) {
+    boost::beast::http::response_parser<JsonBody> parser;
+
+    while (!parser.is_done()) {
+      co_await boost::beast::http::async_read_some(stream, buffer, parser,
+                                                   boost::asio::use_awaitable);
+      deadline.Touch();
+    }
+
+    co_return parser.release();
+  }
+
+  inline Response Do(const Request &request) {
+    const auto start = Deadline::clock::now();
+
+    for (;;) {
+      Pool::Lease lease = pool_.Checkout();
+
+      Response response;
+      {
+        // The deadline watches the socket, so it goes before the connection
+        // is handed back.
+        Deadline deadline{options_, start, lease->native_handle()};
+
+        try {
+          boost::asio::write(lease->stream_, Prepare(*lease, request));
+
+          boost::beast::flat_buffer buffer;
+
+          response = Read(lease->stream_, buffer, deadline);
+        } catch (const boost::beast::system_error &) {
+          deadline.Check();
+          if (!lease.reused() || !request.idempotent())
+            throw;
+          continue;
+        }
+      }
+
+      if (response.keep_alive())
+        lease.Recycle();
+
+      return response;
+    }
+  }
+
+  // Keeps up to pipeline_depth requests in flight on one connection and reads
+  // the responses in order, each under its own deadline. When the server
+  // closes the connection, the requests it did not answer are sent again on
+  // another one.
+  std::vector<Response> Pipeline(const std::vector<Request> &requests) {
+    const std::size_t depth = std::max<std::size_t>(options_.pipeline_depth, 1);
+
+    std::vector<Response> responses;
+    responses.reserve(requests.size());
+    std::vector<Deadline::clock::time_point> sent(requests.size());
+
+    while (responses.size() < requests.size()) {
+      Pool::Lease lease = pool_.Checkout();
+
+      boost::beast::flat_buffer buffer;
+      std::size_t written = responses.size(), answered = 0;
+      bool keep_alive = true;
+
+      while (keep_alive && responses.size() < requests.size()) {
+        const std::size_t next = responses.size();
+        std::optional<Deadline> deadline;
+        Response response;
+
+        try {
+          deadline.emplace(options_,
+                           written > next ? sent[next]
+                                          : Deadline::clock::now(),
+                           lease->native_handle());
+
+          for (; written < requests.size() && written - next < depth;
+               ++written) {
+            sent[written] = Deadline::clock::now();
+            boost::asio::write(lease->stream_,
+                               Prepare(*lease, requests[written]));
+          }
+
+          response = Read(lease->stream_, buffer, *deadline);
+        } catch (const boost::beast::system_error &e) {
+          if (deadline)
+            deadline->Check();
+          // A pooled connection the server had already closed, or one it
+          // closed after some answers: the rest go out on another one.
+          if (!Closed(e.code()) || (!lease.reused() && answered == 0))
+            throw;
+          keep_alive = false;
+          break;
+        }
+
+        deadline.reset();
+        keep_alive = response.keep_alive();
+        responses.push_back(std::move(response));
+        ++answered;
+      }
+
+      if (keep_alive)
+        lease.Recycle();
+    }
+
+    return responses;
+  }
+
+  // Errors that mean the server closed the connection, with or without a
+  // TLS close_notify.
+  static bool Closed(const boost::beast::error_code &ec) {
+    return ec == boost::beast::http::error::end_of_stream ||
+           ec == boost::asio::error::eof ||
+           ec == boost::asio::ssl::error::stream_truncated ||
+           ec == boost::asio::error::connection_reset ||
+           ec == boost::asio::error::broken_pipe;
+  }
+
+  boost::asio::awaitable<Pool::Lease> AsyncCheckout() {
+    auto [connection, reused] = co_await pool_.AsyncCheckout(
+        co_await boost::asio::this_coro::executor, boost::asio::use_awaitable);
+
+    co_return Pool::Lease{pool_, std::move(connection), reused};
+  }
+
+  boost::asio::awaitable<Response> AsyncDo(Request request) {
+    const auto start = Deadline::clock::now();
+
+    for (;;) {
+      Pool::Lease lease = co_await AsyncCheckout();
+
+      Response response;
+      {
+        Deadline deadline{options_, start, lease->native_handle()};
+
+        try {
+          co_await boost::asio::async_write(lease->stream_,
+                                            Prepare(*lease, request),
+                                            boost::asio::use_awaitable);
+
+          boost::beast::flat_buffer buffer;
+
+          response = co_await AsyncRead(lease->stream_, buffer, deadline);
+        } catch (const boost::beast::system_error &) {
+          deadline.Check();
+          if (!lease.reused() || !request.idempotent())
+            throw;
+          continue;
+        }
+      }
+
+      if (response.keep_alive())
+        lease.Recycle();
+
+      co_return response;
+    }
+  }
+
+  boost::asio::awaitable<std::unique_ptr<xai::Choices>>
+  Completion(Request request) {
+    Response response;
+    if (options_.hedge_percentile > 0)
+      response =
+          co_await Hedge(std::move(request), boost::asio::use_awaitable);
+    else
+      response = co_await AsyncDo(std::move(request));
+
+    co_return std::make_unique<xAIContentChoices>(Parse(response));
+  }
+
+  using ResponseSignature = void(std::exception_ptr, Response);
+  using ResponseHandler =
+      boost::asio::any_completion_handler<ResponseSignature>;
+
+  // One hedged request: the first attempt to answer wins and cancels the
+  // other one.
+  struct Race {
+    Race(const boost::asio::any_io_executor &executor, Request &&r,
+         ResponseHandler &&h)
+        : request{std::move(r)}, handler{std::move(h)}, timer{executor} {}
+
+    const Request request;
+    std::mutex mutex;
+    ResponseHandler handler;
+    boost::asio::steady_timer timer;
+    std::array<Abort, 2> aborts;
+    std::size_t running = 0;
+    bool done = false;
+  };
+
+  // Sends the request and, when no response arrived within the configured
+  // percentile of recent latencies, the same request again on another
+  // connection. Only worth it for idempotent requests, such as completions
+  // with a fixed temperature.
+  template <typename CompletionToken>
+  typename boost::asio::async_result<std::decay_t<CompletionToken>,
+                                     ResponseSignature>::return_type
+  Hedge(Request request, CompletionToken &&token) {
+    return boost::asio::async_initiate<CompletionToken, ResponseSignature>(
+        [this](ResponseHandler handler, Request message) {
+          auto race = std::make_shared<Race>(Executor(), std::move(message),
+                                             std::move(handler));
+
+          Launch(race, 0);
+
+          std::optional<Latencies::clock::duration> delay =
+              latencies_.Percentile(options_.hedge_percentile,
+                                    options_.hedge_min_samples);
+          if (!delay)
+            return;
+
+          race->timer.expires_after(*delay);
+          race->timer.async_wait(
+              [this, race](const boost::beast::error_code &ec) {
+                if (!ec)
+                  Launch(race, 1);
+              });
+        },
+        token, std::move(request));
+  }
+
+  void Launch(const std::shared_ptr<Race> &race, std::size_t attempt) {
+    {
+      std::lock_guard<std::mutex> lock{race->mutex};
+      if (race->done)
+        return;
+      ++race->running;
+    }
+
+    boost::asio::co_spawn(
+        Executor(), Attempt(race, attempt),
+        [this, race, attempt](std::exception_ptr e, Response response) {
+          std::unique_lock<std::mutex> lock{race->mutex};
+          --race->running;
+
+          if (race->done || (e && race->running > 0))
+            return;
+
+          race->done = true;
+          race->timer.cancel();
+          race->aborts[1 - attempt].Cancel();
+          ResponseHandler handler = std::move(race->handler);
+          lock.unlock();
+
+          boost::asio::post(Executor(),
+                            boost::asio::append(std::move(handler), e,
+                                                std::move(response)));
+        });
+  }
+
+  boost::asio::awaitable<Response> Attempt(std::shared_ptr<Race> race,
+                                           std::size_t attempt) {
+    const auto start = Latencies::clock::now();
+
+    Pool::Lease lease = co_await AsyncCheckout();
+
+    Response response;
+    {
+      Abort::Scope scope{race->aborts[attempt], lease->native_handle()};
+      Deadline deadline{options_, start, lease->native_handle()};
+
+      try {
+        co_await boost::asio::async_write(lease->stream_,
+                                          Prepare(*lease, race->request),
+                                          boost::asio::use_awaitable);
+
+        boost::beast::flat_buffer buffer;
+
+        response = co_await AsyncRead(lease->stream_, buffer, deadline);
+      } catch (const boost::beast::system_error &) {
+        deadline.Check();
+        throw;
+      }
+    }
+
+    // A cancelled attempt may have had its socket shut down.
+    if (response.keep_alive() && !race->aborts[attempt].cancelled())
+      lease.Recycle();
+
+    latencies_.Record(Latencies::clock::now() - start);
+
+    co_return response;
+  }
+
+  boost::asio::awaitable<void> Streaming(Request request, Call call) {
+    const auto start = Deadline::clock::now();
+
+    Pool::Lease lease = co_await AsyncCheckout();
+
+    EventStream events{ChoicesEvents(call)};
+    {
+      Deadline deadline{options_, start, lease->native_handle()};
+      boost::beast::flat_buffer buffer;
+
+      try {
+        co_await boost::asio::async_write(lease->stream_,
+                                          Prepare(*lease, request),
+                                          boost::asio::use_awaitable);
+
+        co_await boost::beast::http::async_read_header(
+            lease->stream_, buffer, events.parser(),
+            boost::asio::use_awaitable);
+        deadline.Touch();
+        events.CheckStatus();
+
+        while (!events.done()) {
+          boost::beast::error_code ec;
+
+          events.Prepare();
+          co_await boost::beast::http::async_read_some(
+              lease->stream_, buffer, events.parser(),
+              boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+          deadline.Touch();
+          events.Consume(ec);
+        }
+      } catch (const boost::beast::system_error &) {
+        deadline.Check();
+        throw;
+      }
+    }
+
+    if (events.keep_alive())
+      lease.Recycle();
+  }
+
+  boost::asio::awaitable<std::unique_ptr<xai::ModelList>> Models() {
+    Response response = co_await AsyncDo(GetRequest(models_head_));
+
+    co_return std::make_unique<xAIModelList>(Parse(response));
+  }
+
+  boost::asio::awaitable<std::unique_ptr<xai::LanguageModelList>>
+  LanguageModels() {
+    Response response = co_await AsyncDo(GetRequest(language_models_head_));
+
+    co_return std::make_unique<xAILanguageModelList>(Parse(response));
+  }
+};
+
+} // namespace
+
+namespace xai {
+
+Choices::~Choices() = default;
+Messages::~Messages() = default;
+ModelList::~ModelList() = default;
+LanguageModelList::~LanguageModelList() = default;
+DeltaStream::~DeltaStream() = default;
+Client::~Client() = default;
+
+std::unique_ptr<Client> Client::Make(const char *apikey) {
+  return std::make_unique<xAIClient>(apikey);
+}
+
+std::unique_ptr<Client> Client::Make(const char *apikey,
+                                     const Options &options) {
+  return std::make_unique<xAIClient>(apikey, default_host, options);
+}
+
+std::unique_ptr<Client> Client::Make(const char *apikey, const char *host) {
+  return std::make_unique<xAIClient>(apikey, host);
+}
+
+std::unique_ptr<Client> Client::Make(const char *apikey, const char *host,
+                                     const Options &options) {
+  return std::make_unique<xAIClient>(apikey, host, options);
+}
+
+std::unique_ptr<Client> Client::Make(const char *apikey, const char *host,
+                                     const Options &options,
+                                     boost::asio::any_io_executor executor) {
+  return std::make_unique<xAIClient>(apikey, host, options,
+                                     std::move(executor));
 }
 
 std::unique_ptr<Messages> Messages::Make(const char *model) {
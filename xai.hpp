@@ -1,8 +1,20 @@
 #pragma once
 
+#include <boost/asio/any_completion_handler.hpp>
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/async_result.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <exception>
 #include <functional>
+#include <iterator>
 #include <memory>
+#include <span>
+#include <stop_token>
+#include <string>
 #include <string_view>
+#include <vector>
 
 #define XAI_PROTO(T)                                                           \
 public:                                                                        \
@@ -59,9 +71,90 @@ public:
   Traverse(const std::function<void(const LanguageModel &)> &call) = 0;
 };
 
+// A piece of a streamed completion. The views point into a buffer that is
+// reused for the next event, so they are only valid during the callback.
+struct Delta {
+  std::string_view content;
+  std::string_view role;
+  std::string_view finish_reason;
+};
+
+// Deltas of a streamed completion, read from the connection only as they are
+// asked for, so a slow consumer slows the server down through TCP flow
+// control. Each delta stays valid until the next one is requested. Dropping
+// the stream before its end closes the connection.
+class DeltaStream {
+  XAI_PROTO(DeltaStream)
+public:
+  // Returns nullptr once the stream is over.
+  virtual const Delta *Next() = 0;
+
+  class iterator {
+  public:
+    using iterator_concept = std::input_iterator_tag;
+    using value_type = Delta;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+    explicit iterator(DeltaStream *stream)
+        : stream_{stream}, delta_{stream->Next()} {}
+
+    const Delta &operator*() const { return *delta_; }
+    const Delta *operator->() const { return delta_; }
+
+    iterator &operator++() {
+      delta_ = stream_->Next();
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+
+    friend bool operator==(const iterator &it, std::default_sentinel_t) {
+      return it.delta_ == nullptr;
+    }
+
+  private:
+    DeltaStream *stream_ = nullptr;
+    const Delta *delta_ = nullptr;
+  };
+
+  iterator begin() { return iterator{this}; }
+  std::default_sentinel_t end() { return {}; }
+};
+
 class Client {
   XAI_PROTO(Client)
 public:
+  enum class Transport { tls, tcp, local };
+
+  struct Options {
+    std::size_t pool_min = 1;
+    std::size_t pool_max = 4;
+    std::chrono::seconds idle_timeout{30};
+    std::string session_file;
+    bool background_connect = false;
+    std::chrono::seconds dns_ttl{60};
+    std::string ca_file;
+    std::size_t pipeline_depth = 1;
+    std::chrono::milliseconds request_timeout{0};
+    std::chrono::milliseconds first_byte_timeout{0};
+    std::chrono::milliseconds read_timeout{0};
+    double hedge_percentile = 0;
+    std::size_t hedge_min_samples = 20;
+    std::size_t compress_threshold = 0;
+    std::string port = "443";
+    Transport transport = Transport::tls;
+    bool kernel_tls = false;
+    std::string socket_path;
+    std::string proxy;
+    std::string proxy_authorization;
+    // Multiplexes blocking streaming completions over one HTTP/2 connection
+    // when the library is built with XAI_ENABLE_HTTP2 and the server agrees
+    // to it over TLS; everything else keeps using HTTP/1.1.
+    bool http2 = false;
+    std::size_t http2_stream_window = 65535;
+    std::size_t http2_connection_window = 16 << 20;
+  };
+
   [[nodiscard]]
   virtual std::unique_ptr<Choices>
   ChatCompletion(const std::unique_ptr<Messages> &messages) = 0;
@@ -70,17 +163,139 @@ public:
   ChatCompletion(const std::unique_ptr<Messages> &messages,
                  const std::function<void(std::unique_ptr<Choices>)> &call) = 0;
 
+  // Returns as soon as a stop is requested, without reading the rest of the
+  // stream.
+  virtual void
+  ChatCompletion(const std::unique_ptr<Messages> &messages,
+                 const std::function<void(std::unique_ptr<Choices>)> &call,
+                 std::stop_token stop) = 0;
+
+  // Streams the completion without allocating for each event.
+  virtual void
+  StreamChatCompletion(const std::unique_ptr<Messages> &messages,
+                       const std::function<void(const Delta &)> &call,
+                       std::stop_token stop) = 0;
+
+  inline void
+  StreamChatCompletion(const std::unique_ptr<Messages> &messages,
+                       const std::function<void(const Delta &)> &call) {
+    StreamChatCompletion(messages, call, std::stop_token{});
+  }
+
+  // Sends the request and returns once the response headers arrive; the
+  // body is read as the stream is iterated.
+  [[nodiscard]]
+  virtual std::unique_ptr<DeltaStream>
+  StreamChatCompletion(const std::unique_ptr<Messages> &messages) = 0;
+
+  [[nodiscard]]
+  virtual std::vector<std::unique_ptr<Choices>>
+  ChatCompletion(std::span<const std::unique_ptr<Messages>> batch) = 0;
+
+  virtual void Prewarm() = 0;
+
+  // Whether a pooled connection has its TLS record layer offloaded to the
+  // kernel. Always false without kernel_tls.
+  [[nodiscard]]
+  virtual bool KernelTlsActive() = 0;
+
   [[nodiscard]]
   virtual std::unique_ptr<ModelList> ListModels() = 0;
 
   [[nodiscard]]
   virtual std::unique_ptr<LanguageModelList> ListLanguageModels() = 0;
 
+  // Asynchronous variants accept any Asio completion token (callbacks,
+  // use_future, use_awaitable, ...). The messages are copied when the
+  // operation is initiated and serialized when the request is sent, so they
+  // may change right after the call. The client must outlive every operation.
+  template <typename CompletionToken>
+  auto AsyncChatCompletion(const std::unique_ptr<Messages> &messages,
+                           CompletionToken &&token) {
+    return boost::asio::async_initiate<
+        CompletionToken, void(std::exception_ptr, std::unique_ptr<Choices>)>(
+        [this](auto handler, const Messages *m) {
+          InitiateChatCompletion(*m, ChoicesHandler{std::move(handler)});
+        },
+        token, messages.get());
+  }
+
+  template <typename CompletionToken>
+  auto AsyncChatCompletion(const std::unique_ptr<Messages> &messages,
+                           std::function<void(std::unique_ptr<Choices>)> call,
+                           CompletionToken &&token) {
+    return boost::asio::async_initiate<CompletionToken,
+                                       void(std::exception_ptr)>(
+        [this](auto handler, const Messages *m,
+               std::function<void(std::unique_ptr<Choices>)> c) {
+          InitiateChatCompletion(*m, std::move(c),
+                                 StreamHandler{std::move(handler)});
+        },
+        token, messages.get(), std::move(call));
+  }
+
+  template <typename CompletionToken>
+  auto AsyncListModels(CompletionToken &&token) {
+    return boost::asio::async_initiate<
+        CompletionToken, void(std::exception_ptr, std::unique_ptr<ModelList>)>(
+        [this](auto handler) {
+          InitiateListModels(ModelListHandler{std::move(handler)});
+        },
+        token);
+  }
+
+  template <typename CompletionToken>
+  auto AsyncListLanguageModels(CompletionToken &&token) {
+    return boost::asio::async_initiate<
+        CompletionToken,
+        void(std::exception_ptr, std::unique_ptr<LanguageModelList>)>(
+        [this](auto handler) {
+          InitiateListLanguageModels(
+              LanguageModelListHandler{std::move(handler)});
+        },
+        token);
+  }
+
   [[nodiscard]]
   static std::unique_ptr<Client> Make(const char *apikey);
 
+  [[nodiscard]]
+  static std::unique_ptr<Client> Make(const char *apikey,
+                                      const Options &options);
+
   [[nodiscard]]
   static std::unique_ptr<Client> Make(const char *apikey, const char *host);
+
+  [[nodiscard]]
+  static std::unique_ptr<Client> Make(const char *apikey, const char *host,
+                                      const Options &options);
+
+  [[nodiscard]]
+  static std::unique_ptr<Client> Make(const char *apikey, const char *host,
+                                      const Options &options,
+                                      boost::asio::any_io_executor executor);
+
+protected:
+  using ChoicesHandler = boost::asio::any_completion_handler<void(
+      std::exception_ptr, std::unique_ptr<Choices>)>;
+  using StreamHandler =
+      boost::asio::any_completion_handler<void(std::exception_ptr)>;
+  using ModelListHandler = boost::asio::any_completion_handler<void(
+      std::exception_ptr, std::unique_ptr<ModelList>)>;
+  using LanguageModelListHandler = boost::asio::any_completion_handler<void(
+      std::exception_ptr, std::unique_ptr<LanguageModelList>)>;
+
+  virtual void InitiateChatCompletion(const Messages &messages,
+                                      ChoicesHandler handler) = 0;
+
+  virtual void
+  InitiateChatCompletion(const Messages &messages,
+                         std::function<void(std::unique_ptr<Choices>)> call,
+                         StreamHandler handler) = 0;
+
+  virtual void InitiateListModels(ModelListHandler handler) = 0;
+
+  virtual void InitiateListLanguageModels(LanguageModelListHandler handler) = 0;
 };
 
 } // namespace xai